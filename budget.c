@@ -0,0 +1,115 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "gc.h"
+#include "budget.h"
+
+
+int budgeting = 0;
+
+/*
+ * The limits are absolute: the last step allowed, the most bytes in use
+ * and the deadline. -1 (or a deadline of 0) means there is no limit.
+ */
+static budget_t budget = { 0, -1, -1, 0, BUDGET_OK };
+static long budget_count = 0;
+
+
+static double budget_clock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void budget_push(budget_t* saved, long steps, long millis, long bytes) {
+  double deadline;
+
+  (*saved) = budget;
+
+  if (steps) {
+    steps += budget_count;
+
+    if (budget.steps < 0 || steps < budget.steps) {
+      budget.steps = steps;
+    }
+  }
+
+  if (bytes) {
+    bytes += gc_bytes();
+
+    if (budget.bytes < 0 || bytes < budget.bytes) {
+      budget.bytes = bytes;
+    }
+  }
+
+  if (millis) {
+    deadline = budget_clock() + millis / 1000.0;
+
+    if (!budget.deadline || deadline < budget.deadline) {
+      budget.deadline = deadline;
+    }
+  }
+
+  budget.active = 1;
+  budget.exceeded = BUDGET_OK;
+
+  budgeting = 1;
+}
+
+
+int budget_pop(budget_t* saved) {
+  int ret = budget.exceeded;
+
+  budget = (*saved);
+  budgeting = budget.active;
+
+  return ret;
+}
+
+
+int budget_step(void) {
+  budget_count++;
+
+  if (budget.exceeded) {
+    return budget.exceeded;
+  }
+
+  if (budget.steps >= 0 && budget_count > budget.steps) {
+    budget.exceeded = BUDGET_STEPS;
+
+  } else if (budget.bytes >= 0 && gc_bytes() > budget.bytes) {
+    budget.exceeded = BUDGET_MEMORY;
+
+  } else if (budget.deadline && !(budget_count % BUDGET_CLOCK) &&
+	     budget_clock() > budget.deadline) {
+    budget.exceeded = BUDGET_TIME;
+  }
+
+  return budget.exceeded;
+}
+
+
+long budget_left(void) {
+  double left;
+
+  if (!budget.deadline) return -1;
+
+  left = (budget.deadline - budget_clock()) * 1000;
+
+  return (left > 0 ? (long)left : 0);
+}
+
+
+void budget_expire(void) {
+  budget.exceeded = BUDGET_TIME;
+}
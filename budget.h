@@ -0,0 +1,54 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __budget_h__
+#define __budget_h__
+
+/*
+ * Budgets, for "with-budget". While "budgeting" is set, "budget_step"
+ * is called for every command run, and returns one of the BUDGET_
+ * values once a limit has been passed; the caller then raises the
+ * exception flag, which unwinds everything up to "with-budget".
+ *
+ * Pitfalls:
+ *
+ *  + Budgets nest; an inner budget can only be tighter than the outer one.
+ *    "budget_pop" must be given what "budget_push" saved.
+ *  + The clock is only looked at every BUDGET_CLOCK steps. While an
+ *    external command runs, the shell waits for it for no longer than
+ *    "budget_left" milliseconds (-1 means no deadline), and then kills
+ *    it and calls "budget_expire".
+ *  + The memory budget is on the growth of the memory in use, as counted
+ *    by "gc_bytes".
+ */
+
+#define BUDGET_OK       0
+#define BUDGET_STEPS    1
+#define BUDGET_TIME     2
+#define BUDGET_MEMORY   3
+
+#define BUDGET_CLOCK    64
+#define BUDGET_GRACE    1000
+
+typedef struct budget_t budget_t;
+
+struct budget_t {
+  int active;
+  long steps;
+  long bytes;
+  double deadline;
+  int exceeded;
+};
+
+extern int budgeting;
+
+extern void budget_push(budget_t* saved, long steps, long millis, long bytes);
+extern int budget_pop(budget_t* saved);
+extern int budget_step(void);
+extern long budget_left(void);
+extern void budget_expire(void);
+
+#endif /* !__budget_h__ */
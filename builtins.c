@@ -13,6 +13,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
 
 #include <regex.h>
 
@@ -21,13 +23,26 @@
 #include "list.h"
 #include "gc.h"
 #include "hash.h"
+#include "memo.h"
+#include "profile.h"
+#include "trace.h"
+#include "budget.h"
+#include "stream.h"
+#include "coproc.h"
+#include "plugin.h"
+#include "path.h"
+#include "parallel.h"
 #include "job.h"
+#include "token.h"
 #include "esh.h"
 #include "builtins.h"
 #include "read.h"
 
 
 
+int result_kind = RESULT_OWNED;
+
+
 static int typecheck_aux(char* tspec, list* data, int* i, int quiet) {
   int len = strlen(tspec);
   int err = 0;
@@ -52,6 +67,8 @@ static int typecheck_aux(char* tspec, list* data, int* i, int quiet) {
     case 'b':
     case 'f':
     case 'p':
+    case 'r':
+    case 'c':
       {
 	int type = TYPE_STRING;
 
@@ -62,6 +79,8 @@ static int typecheck_aux(char* tspec, list* data, int* i, int quiet) {
 	case 'b':     type = TYPE_BOOL;   break;
 	case 'f':     type = TYPE_FD;     break;
 	case 'p':     type = TYPE_PROC;   break;
+	case 'r':     type = TYPE_STREAM; break;
+	case 'c':     type = TYPE_COPROC; break;
 	}
 
 	if (ls_type(data) != type) err = 1;
@@ -105,6 +124,8 @@ static int typecheck_aux(char* tspec, list* data, int* i, int quiet) {
     case 'B':
     case 'F':
     case 'P':
+    case 'R':
+    case 'C':
       {
 	int type = TYPE_STRING;
 
@@ -115,6 +136,8 @@ static int typecheck_aux(char* tspec, list* data, int* i, int quiet) {
 	case 'B':     type = TYPE_BOOL;   break;
 	case 'F':     type = TYPE_FD;     break;
 	case 'P':     type = TYPE_PROC;   break;
+	case 'R':     type = TYPE_STREAM; break;
+	case 'C':     type = TYPE_COPROC; break;
 	}
 
 	if (ls_type(data) != type) {
@@ -178,8 +201,8 @@ static inline int quiet_typecheck(char* tspec, list* arg) {
 }
 
 
-static int fancy_typecheck(char* tspec, list* arg,
-			   char* cmdname, char* cmddesc) {
+int fancy_typecheck(char* tspec, list* arg,
+		    char* cmdname, char* cmddesc) {
 
   int ret = typecheck(tspec, arg);
 
@@ -217,6 +240,14 @@ static int fancy_typecheck(char* tspec, list* arg,
 	printf("<process>");
 	break;
 
+      case 'r':
+	printf("<stream>");
+	break;
+
+      case 'c':
+	printf("<coprocess>");
+	break;
+
       case '?':
 	printf("<any>");
 	break;
@@ -245,6 +276,14 @@ static int fancy_typecheck(char* tspec, list* arg,
 	printf("<process>...");
 	break;
 
+      case 'R':
+	printf("<stream>...");
+	break;
+
+      case 'C':
+	printf("<coprocess>...");
+	break;
+
       case '*':
 	printf("...");
 	break;
@@ -283,6 +322,61 @@ static long do_atoi(char* dat, int* err, long def) {
   return ret;
 }
 
+/*
+ * Return a list of fresh nodes that borrow the data of "ls", up to "n"
+ * nodes long (or the whole list if "n" is negative). See builtins.h.
+ */
+static list* borrow(list* ls, int n) {
+  list* ret = NULL;
+  list* last = NULL;
+  list* nw;
+
+  for (; ls != NULL && n; ls = ls_next(ls), n--) {
+    nw = ls_cons(ls_data(ls), NULL);
+    ls_type_set(nw, ls_type(ls));
+    ls_flag_set(nw, ls_flag(ls));
+
+    ls_append(&ret, &last, nw);
+  }
+
+  result_kind = RESULT_BORROWED;
+
+  return ret;
+}
+
+
+/*
+ * Can the values returned by a command be passed on as they are to
+ * the command "cmd"? Defined commands are fine, since the arguments are
+ * copied to their stack before anything gets run.
+ */
+static int borrow_p(list* cmd) {
+  void* func;
+
+  if (!cmd || ls_type(cmd) != TYPE_STRING) return 0;
+
+  if (hash_get(defines, ls_data(cmd))) return 1;
+
+  func = hash_get(borrowers, ls_data(cmd));
+
+  return (func && func == hash_get(builtins, ls_data(cmd)));
+}
+
+
+/*
+ * Is there nothing after "iter" that would be evaluated? Only then can a
+ * borrowed value be passed on, since any subcommand can pop the stack
+ * and free what it was borrowed from.
+ */
+static int eval_last_p(list* iter, int strength) {
+  for (; iter != NULL; iter = ls_next(iter)) {
+    if (ls_type(iter) == TYPE_LIST && strength >= ls_flag(iter)) return 0;
+  }
+
+  return 1;
+}
+
+
 list* car(list* arg) {
   list* ret = NULL;
   list* foo;
@@ -298,6 +392,8 @@ list* car(list* arg) {
   case TYPE_STRING:
   case TYPE_FD:
   case TYPE_PROC:
+  case TYPE_STREAM:
+  case TYPE_COPROC:
     gc_inc_ref(ls_data(arg));
     ret = ls_cons(ls_data(arg), NULL);
     break;
@@ -411,11 +507,31 @@ static list* help(list* arg) {
 }
 
 
-list* eval_aux(list* arg, int mode, int strength) {
+/*
+ * When "mode" is set, the evaluated list is passed to "do_builtin" as an
+ * argument list. Argument lists only borrow their values: nothing is
+ * copied and no reference counts are touched, since builtins copy
+ * whatever they want to keep. The values returned by subcommands are
+ * owned by "junk" until the builtin returns, except for borrowed values
+ * (see builtins.h), which are passed on as they are when that is safe.
+ *
+ * Otherwise, the caller gets a list that owns all its values.
+ *
+ * "kind" is set to the ownership of the returned list.
+ */
+
+list* eval_aux(list* arg, int mode, int strength, int* kind) {
   list* iter;
   list* ret = NULL;
+  list* last = NULL;
+  list* junk = NULL;
   list* tmp;
   list* tmp2;
+  list* nw;
+  int tmpkind;
+  int safe = -1;
+
+  (*kind) = RESULT_OWNED;
 
   for (iter = arg; iter != NULL; iter = ls_next(iter)) {
 
@@ -430,29 +546,72 @@ list* eval_aux(list* arg, int mode, int strength) {
 
 	if (strength < ls_flag(iter)) {
 
-	  ret = ls_cons(ls_copy(rec), ret);
-	  ls_type_set(ret, TYPE_LIST);
-	  ls_flag_set(ret, ls_flag(iter));
+	  nw = ls_cons((mode ? rec : ls_copy(rec)), NULL);
+	  ls_type_set(nw, TYPE_LIST);
+	  ls_flag_set(nw, ls_flag(iter));
+
+	  ls_append(&ret, &last, nw);
 
 	} else {
 
-	  tmp = eval_aux(rec, 1, strength);
+	  tmp = eval_aux(rec, 1, strength, &tmpkind);
+
+	  if (tmpkind == RESULT_BORROWED) {
+	    if (mode && safe < 0) {
+	      safe = borrow_p(ret);
+	    }
+
+	    if (!mode || !safe || !eval_last_p(ls_next(iter), strength)) {
+	      ls_claim(tmp);
+	      tmpkind = RESULT_OWNED;
+	    }
+	  }
+
+	  if (!tmp) {
+	    nw = ls_cons(NULL, NULL);
+	    ls_type_set(nw, TYPE_LIST);
+
+	    ls_append(&ret, &last, nw);
+
+	  } else if (mode && tmpkind == RESULT_BORROWED) {
+	    /* Fresh nodes, link them in as they are. */
+	    while (tmp) {
+	      tmp2 = ls_take(&tmp);
+
+	      if (ls_type(tmp2) == TYPE_VOID) {
+		gc_free(tmp2);
+		continue;
+	      }
 
-	  if (tmp) {
+	      ls_append(&ret, &last, tmp2);
+	    }
+
+	  } else if (mode) {
 	    for (tmp2 = tmp; tmp2 != NULL; tmp2 = ls_next(tmp2)) {
 
 	      if (ls_type(tmp2) == TYPE_VOID) continue;
 
-	      ret = ls_cons(ls_data(tmp2), ret);
-	      ls_type_set(ret, ls_type(tmp2));
-	      ls_flag_set(ret, ls_flag(tmp2));
+	      nw = ls_cons(ls_data(tmp2), NULL);
+	      ls_type_set(nw, ls_type(tmp2));
+	      ls_flag_set(nw, ls_flag(tmp2));
+
+	      ls_append(&ret, &last, nw);
 	    }
 
-	    ls_free_shallow(tmp);
+	    junk = ls_cons(tmp, junk);
+	    ls_type_set(junk, TYPE_LIST);
 
 	  } else {
-	    ret = ls_cons(NULL, ret);
-	    ls_type_set(ret, TYPE_LIST);
+	    while (tmp) {
+	      tmp2 = ls_take(&tmp);
+
+	      if (ls_type(tmp2) == TYPE_VOID) {
+		gc_free(tmp2);
+		continue;
+	      }
+
+	      ls_append(&ret, &last, tmp2);
+	    }
 	  }
 	}
       }
@@ -462,38 +621,47 @@ list* eval_aux(list* arg, int mode, int strength) {
     case TYPE_STRING:
     case TYPE_FD:
     case TYPE_PROC:
-      gc_inc_ref(ls_data(iter));
-      ret = ls_cons(ls_data(iter), ret);
+    case TYPE_STREAM:
+    case TYPE_COPROC:
+      if (!mode) {
+	gc_inc_ref(ls_data(iter));
+      }
+
+      nw = ls_cons(ls_data(iter), NULL);
+      ls_type_set(nw, ls_type(iter));
+      ls_flag_set(nw, ls_flag(iter));
 
-      ls_type_set(ret, ls_type(iter));
-      ls_flag_set(ret, ls_flag(iter));
+      ls_append(&ret, &last, nw);
       break;
 
     case TYPE_HASH:
-      hash_inc_ref(ls_data(iter));
-      gc_inc_ref(ls_data(iter));
+      if (!mode) {
+	hash_inc_ref(ls_data(iter));
+	gc_inc_ref(ls_data(iter));
+      }
 
-      ret = ls_cons(ls_data(iter), ret);
+      nw = ls_cons(ls_data(iter), NULL);
+      ls_type_set(nw, TYPE_HASH);
+      ls_flag_set(nw, ls_flag(iter));
 
-      ls_type_set(ret, TYPE_HASH);
-      ls_flag_set(ret, ls_flag(iter));
+      ls_append(&ret, &last, nw);
       break;
 
     case TYPE_BOOL:
-      ret = ls_cons(ls_data(iter), ret);
+      nw = ls_cons(ls_data(iter), NULL);
+      ls_type_set(nw, TYPE_BOOL);
+      ls_flag_set(nw, ls_flag(iter));
 
-      ls_type_set(ret, TYPE_BOOL);
-      ls_flag_set(ret, ls_flag(iter));
+      ls_append(&ret, &last, nw);
       break;
     }
   }
 
-  ret = ls_reverse(ret);
-
   if (mode) {
-    tmp = do_builtin(ret);
+    tmp = do_builtin_kind(ret, kind);
 
-    ls_free_all(ret);
+    ls_free_shallow(ret);
+    ls_free_all(junk);
 
     return tmp;
 
@@ -505,8 +673,55 @@ list* eval_aux(list* arg, int mode, int strength) {
 
 inline list* eval(list* arg) {
   list* ret;
+  int kind;
+
+  ret = eval_aux(arg, 0, 0, &kind);
 
-  ret = eval_aux(arg, 0, 0);
+  return ret;
+}
+
+
+/*
+ * Like "eval" on the result of "car", but without copying anything: only
+ * the first node of "arg" is evaluated, in place. This is what "if",
+ * "and", "or", "while" and friends use to run their (delayed) arguments.
+ */
+list* eval_first(list* arg) {
+  list* ret = NULL;
+  list* last = NULL;
+  list* tmp;
+  list* nw;
+  int kind;
+
+  if (!arg) return NULL;
+
+  if (ls_type(arg) != TYPE_LIST) {
+    return car(arg);
+  }
+
+  tmp = eval_aux(ls_data(arg), 1, ls_flag(arg), &kind);
+
+  if (kind == RESULT_BORROWED) {
+    ls_claim(tmp);
+  }
+
+  if (!tmp) {
+    ret = ls_cons(NULL, NULL);
+    ls_type_set(ret, TYPE_LIST);
+
+    return ret;
+  }
+
+  while (tmp) {
+    nw = ls_take(&tmp);
+
+    if (ls_type(nw) == TYPE_VOID) {
+      gc_free(nw);
+      continue;
+    }
+
+    ls_append(&ret, &last, nw);
+  }
 
   return ret;
 }
@@ -534,6 +749,10 @@ static list* set(list* arg) {
 
   putenv(str);
 
+  if (strcmp(key, "PATH") == 0) {
+    path_rehash();
+  }
+
   return NULL;
 }
 
@@ -609,6 +828,9 @@ static list* run(list* arg) {
 
       foo = (pid_t*)gc_alloc(sizeof(pid_t), "run");
       (*foo) = ret;
+
+      /* So that "wait-process" can tell even once it is reaped. */
+      job_expect(ret);
       bar = ls_cons(foo, NULL);
       ls_type_set(bar, TYPE_PROC);
 
@@ -645,11 +867,14 @@ static list* run_simple(list* arg) {
   return ls_cons(decchar, NULL);
 }
 
+#define GOBBLE_WAIT 1000
+
 static list* gobble(list* arg) {
   int pfd[2];
   int* fd;
   list* ret;
   pid_t foo;
+  int status;
 
   if (fancy_typecheck("fL", arg, "gobble",
 		      "This command is equivalent to \"run\", except "
@@ -675,15 +900,264 @@ static list* gobble(list* arg) {
 
   if (foo < 0) return NULL;
 
+  job_expect(foo);
+
   ret = ls_cons(file_read(pfd[0]), NULL);
 
   close(pfd[0]);
   close(pfd[1]);
 
+  /*
+   * With its output over, the pipeline is as good as done. Reap it
+   * now, so that "time" gets to count it.
+   */
+  status = JOB_PENDING;
+  job_await(&foo, &status, 1, 1, GOBBLE_WAIT);
+  job_forget(foo);
+
+  return ret;
+}
+
+
+static list* parallel(list* arg) {
+  int limit;
+  int err;
+
+  if (fancy_typecheck("sL", arg, "parallel",
+		      "This command runs the given pipelines at the same "
+		      "time, but never more\nthan the first argument at "
+		      "once. Each pipeline is a list of commands,\n"
+		      "optionally starting with an input file. It returns "
+		      "a list of\n\"(output status)\" lists, in the same "
+		      "order as the pipelines.")) {
+    return NULL;
+  }
+
+  limit = do_atoi(ls_data(arg), &err, 0);
+
+  if (err || limit < 1) {
+    error("esh: parallel: the job limit should be a positive number.");
+    return NULL;
+  }
+
+  return parallel_run(limit, ls_next(arg));
+}
+
+
+static list* stream(list* arg) {
+  int pfd[2];
+  int* fd;
+  list* ret;
+  pid_t foo;
+
+  if (fancy_typecheck("fL", arg, "stream",
+		      "This command is equivalent to \"gobble\", except "
+		      "that it returns\na stream right away. The output "
+		      "of the pipeline can then be read\na line at a "
+		      "time from the stream.")) {
+    return NULL;
+  }
+
+  if (pipe(pfd)) {
+    error("esh: stream: could not create a pipe.");
+    return NULL;
+  }
+
+  fd = ls_data(arg);
+
+  fcntl(pfd[0], F_SETFD, 1);
+  fcntl(pfd[1], F_SETFD, 1);
+
+  foo = do_pipe(fd[0], pfd[1], ls_next(arg), 1, 1);
+
+  if (foo < 0) {
+    close(pfd[0]);
+    close(pfd[1]);
+
+    return NULL;
+  }
+
+  ret = ls_cons(stream_new(pfd[0]), NULL);
+  ls_type_set(ret, TYPE_STREAM);
+
+  return ret;
+}
+
+
+static list* stream_next(list* arg) {
+  char* line;
+
+  if (fancy_typecheck("r", arg, "stream-next",
+		      "This command returns the next line of the stream, "
+		      "without the\nnewline, or an empty list at the "
+		      "end of the stream.")) {
+    return NULL;
+  }
+
+  line = stream_line(ls_data(arg));
+
+  if (!line) return NULL;
+
+  return ls_cons(line, NULL);
+}
+
+
+static list* stream_lines(list* arg) {
+  list* ret = NULL;
+  list* last = NULL;
+  char* line;
+  int n = -1;
+  int err = 0;
+
+  if (fancy_typecheck((arg && ls_next(arg) ? "rs" : "r"), arg,
+		      "stream-lines",
+		      "This command returns the next lines of the "
+		      "stream, as a list of\nstrings. The optional "
+		      "second argument is the most lines to return;\n"
+		      "without it, the rest of the stream is "
+		      "returned.")) {
+    return NULL;
+  }
+
+  if (ls_next(arg)) {
+    n = do_atoi(ls_data(ls_next(arg)), &err, 0);
+
+    if (err || n < 0) {
+      error("esh: stream-lines: the number of lines must be a number.");
+      return NULL;
+    }
+  }
+
+  for (; n && (line = stream_line(ls_data(arg))); n--) {
+    ls_append(&ret, &last, ls_cons(line, NULL));
+  }
+
+  ret = ls_cons(ret, NULL);
+  ls_type_set(ret, TYPE_LIST);
+
+  return ret;
+}
+
+
+static list* stream_eof_p(list* arg) {
+  if (fancy_typecheck("r", arg, "stream-eof?",
+		      "This command returns \"true\" if there is nothing "
+		      "more to read\nfrom the stream. It waits until "
+		      "it knows.")) {
+    return NULL;
+  }
+
+  if (stream_eof(ls_data(arg))) {
+    return ls_copy(ls_true);
+
+  } else {
+    return ls_copy(ls_false);
+  }
+}
+
+
+static list* coproc(list* arg) {
+  coproc_t* c;
+  list* ret;
+
+  if (fancy_typecheck("L", arg, "coproc",
+		      "This command starts the pipeline in the background "
+		      "and returns a\ncoprocess, which is connected to "
+		      "both the input and the output\nof the pipeline. "
+		      "Use \"coproc-send\" and \"coproc-recv-line\" to "
+		      "talk\nto it, and \"coproc-close\" to stop it.")) {
+    return NULL;
+  }
+
+  c = coproc_new(arg);
+
+  if (!c) return NULL;
+
+  ret = ls_cons(c, NULL);
+  ls_type_set(ret, TYPE_COPROC);
+
   return ret;
 }
 
 
+static list* coproc_send_cmd(list* arg) {
+  coproc_t* c;
+  list* iter;
+  char* str;
+
+  if (fancy_typecheck("cS", arg, "coproc-send",
+		      "This command sends each string to the coprocess, "
+		      "as a line\nof its input. The lines are buffered "
+		      "until the next \"coproc-recv-line\"\nor "
+		      "\"coproc-close\".")) {
+    return NULL;
+  }
+
+  c = ls_data(arg);
+
+  if (c->fd < 0) {
+    error("esh: coproc-send: the coprocess is closed.");
+    return NULL;
+  }
+
+  for (iter = ls_next(arg); iter != NULL; iter = ls_next(iter)) {
+    str = ls_data(iter);
+
+    if (coproc_send(c, str, strlen(str)) || coproc_send(c, "\n", 1)) {
+      error("esh: coproc-send: could not write to the coprocess.");
+      return NULL;
+    }
+  }
+
+  return NULL;
+}
+
+
+static list* coproc_recv_line(list* arg) {
+  char* line;
+
+  if (fancy_typecheck("c", arg, "coproc-recv-line",
+		      "This command returns the next line of output of "
+		      "the coprocess,\nwithout the newline, or an empty "
+		      "list at the end of the output.")) {
+    return NULL;
+  }
+
+  line = coproc_line(ls_data(arg));
+
+  if (!line) return NULL;
+
+  return ls_cons(line, NULL);
+}
+
+
+static list* coproc_close_cmd(list* arg) {
+  coproc_t* c;
+  char* decchar;
+
+  if (fancy_typecheck("c", arg, "coproc-close",
+		      "This command closes the input of the coprocess, "
+		      "waits for it\nto quit and returns its exit "
+		      "status. Output that wasn't read yet\nis thrown "
+		      "away.")) {
+    return NULL;
+  }
+
+  c = ls_data(arg);
+
+  if (c->fd < 0) {
+    error("esh: coproc-close: the coprocess is already closed.");
+    return NULL;
+  }
+
+  decchar = (char*)gc_alloc(sizeof(char) * 12, "coproc_close_cmd");
+
+  sprintf(decchar, "%d", coproc_close(c));
+
+  return ls_cons(decchar, NULL);
+}
+
+
 static list* my_exit(list* arg) {
   int stat = EXIT_SUCCESS;
   int err = 0;
@@ -907,47 +1381,180 @@ static list* my_eval(list* arg) {
 }
 
 
-static job_t* nth_job(int i) {
-  int j;
-  list* iter = jobs;
-
-  for (j = 0; j < i; j++) {
-    if (!iter) return NULL;
+static list* with_budget(list* arg) {
+  budget_t saved;
+  list* ret;
+  long steps, millis, bytes;
+  int err1, err2, err3;
+  int why;
 
-    iter = ls_next(iter);
+  if (fancy_typecheck("sss*", arg, "with-budget",
+		      "This command works like \"eval\" on the arguments "
+		      "after the third,\nbut gives up when it runs more "
+		      "commands than the first argument,\ntakes more "
+		      "milliseconds than the second argument, or uses "
+		      "more bytes\nof memory than the third argument. "
+		      "Zero means no limit.\n"
+		      "A command still running at the deadline is "
+		      "terminated, and killed a second\nlater if it is "
+		      "still there.\n"
+		      "Example: (with-budget 10000 500 0 ~(foo))")) {
+    return NULL;
   }
 
-  return ls_data(iter);
-}
-
+  steps = do_atoi(ls_data(arg), &err1, 0);
+  millis = do_atoi(ls_data(ls_next(arg)), &err2, 0);
+  bytes = do_atoi(ls_data(ls_next(ls_next(arg))), &err3, 0);
 
-static list* fg(list* arg) {
-  if (arg &&
-      fancy_typecheck("s", arg, "fg",
-		      "This command brings a job into the foreground.\n"
-		      "The optional argument specifies which job number "
-		      "to use, as given by (jobs).\nIf without arguments, "
-		      "the first job will be used.")) {
+  if (err1 || err2 || err3 || steps < 0 || millis < 0 || bytes < 0) {
+    error("esh: with-budget: the limits must be numbers.");
     return NULL;
   }
 
-  if (!jobs) {
-    error("esh: fg: no jobs are running.");
+  budget_push(&saved, steps, millis, bytes);
 
-  } else {
-    job_t* job;
-    int i = 0, err = 0;
+  ret = eval(ls_next(ls_next(ls_next(arg))));
 
-    if (arg) {
-      i = do_atoi(ls_data(arg), &err, i);
+  why = budget_pop(&saved);
 
-      if (err) {
-	error("esh: fg: \"fg\" accepts only a numeric argument.");
-	return NULL;
-      }
-    }
+  if (why) {
+    ls_free_all(ret);
+    exception_flag = 0;
 
-    job = nth_job(i);
+    error("esh: with-budget: %s limit exceeded.",
+	  (why == BUDGET_STEPS ? "command" :
+	   (why == BUDGET_TIME ? "time" :
+	    "memory")));
+
+    return NULL;
+  }
+
+  return ret;
+}
+
+
+/*
+ * The seconds between two times, for "time".
+ */
+static double time_diff(struct timeval* a, struct timeval* b) {
+  return (b->tv_sec - a->tv_sec) + (b->tv_usec - a->tv_usec) / 1e6;
+}
+
+
+static void time_figure(list** ret, list** last, char* name, char* fmt,
+			double val) {
+  char* num = (char*)gc_alloc(sizeof(char) * 32, "time_figure");
+  list* pair;
+
+  sprintf(num, fmt, val);
+
+  pair = ls_cons(dynamic_strcpy(name), ls_cons(num, NULL));
+  pair = ls_cons(pair, NULL);
+  ls_type_set(pair, TYPE_LIST);
+
+  ls_append(ret, last, pair);
+}
+
+
+static list* my_time(list* arg) {
+  struct timeval wall0, wall1;
+  struct rusage self0, self1;
+  struct rusage kids0;
+  long procs0;
+  long rss0;
+  list* ret = NULL;
+  list* last = NULL;
+
+  if (fancy_typecheck("*", arg, "time",
+		      "This command works like \"eval\", but returns how "
+		      "long that took\ninstead: a list of \"(wall "
+		      "seconds)\", \"(user seconds)\", \"(sys seconds)\",\n"
+		      "\"(rss kilobytes)\", \"(switches number)\" and "
+		      "\"(processes number)\".\nThe memory is the most "
+		      "any of the processes waited for used, and\nthe "
+		      "processes are the ones started. Pipelines still "
+		      "running\nwhen the evaluation is over, such as a "
+		      "\"stream\"'s, are not counted.")) {
+    return NULL;
+  }
+
+  gettimeofday(&wall0, NULL);
+  getrusage(RUSAGE_SELF, &self0);
+
+  kids0 = job_usage;
+  procs0 = job_procs;
+
+  rss0 = job_usage.ru_maxrss;
+  job_usage.ru_maxrss = 0;
+
+  ls_free_all(eval(arg));
+
+  /* Pipelines that were not waited for, such as "gobble"'s. */
+  job_reap();
+
+  gettimeofday(&wall1, NULL);
+  getrusage(RUSAGE_SELF, &self1);
+
+  time_figure(&ret, &last, "wall", "%.3f", time_diff(&wall0, &wall1));
+
+  time_figure(&ret, &last, "user", "%.3f",
+	      time_diff(&self0.ru_utime, &self1.ru_utime) +
+	      time_diff(&kids0.ru_utime, &job_usage.ru_utime));
+
+  time_figure(&ret, &last, "sys", "%.3f",
+	      time_diff(&self0.ru_stime, &self1.ru_stime) +
+	      time_diff(&kids0.ru_stime, &job_usage.ru_stime));
+
+  time_figure(&ret, &last, "rss", "%.0f", job_usage.ru_maxrss);
+
+  time_figure(&ret, &last, "switches", "%.0f",
+	      (self1.ru_nvcsw - self0.ru_nvcsw) +
+	      (self1.ru_nivcsw - self0.ru_nivcsw) +
+	      (job_usage.ru_nvcsw - kids0.ru_nvcsw) +
+	      (job_usage.ru_nivcsw - kids0.ru_nivcsw));
+
+  time_figure(&ret, &last, "processes", "%.0f", job_procs - procs0);
+
+  if (job_usage.ru_maxrss < rss0) {
+    job_usage.ru_maxrss = rss0;
+  }
+
+  ret = ls_cons(ret, NULL);
+  ls_type_set(ret, TYPE_LIST);
+
+  return ret;
+}
+
+
+static list* fg(list* arg) {
+  if (arg &&
+      fancy_typecheck("s", arg, "fg",
+		      "This command brings a job into the foreground.\n"
+		      "The optional argument specifies which job number "
+		      "to use, as given by (jobs).\nIf without arguments, "
+		      "the newest job will be used.")) {
+    return NULL;
+  }
+
+  job_reap();
+
+  if (job_last() < 0) {
+    error("esh: fg: no jobs are running.");
+
+  } else {
+    job_t* job;
+    int i = job_last(), err = 0;
+
+    if (arg) {
+      i = do_atoi(ls_data(arg), &err, i);
+
+      if (err) {
+	error("esh: fg: \"fg\" accepts only a numeric argument.");
+	return NULL;
+      }
+    }
+
+    job = job_get(i);
 
     if (!job) {
       error("esh: fg: invalid job number.");
@@ -969,16 +1576,18 @@ static list* bg(list* arg) {
 		      "This command brings a job into the background.\n"
 		      "The optional argument specifies which job number "
 		      "to use, as given by (jobs).\nIf without arguments, "
-		      "the first job will be used.")) {
+		      "the newest job will be used.")) {
     return NULL;
   }
 
-  if (!jobs) {
+  job_reap();
+
+  if (job_last() < 0) {
     error("esh: bg: no jobs are running.");
 
   } else {
     job_t* job;
-    int i = 0, err = 0;
+    int i = job_last(), err = 0;
 
     if (arg) {
       i = do_atoi(ls_data(arg), &err, i);
@@ -989,7 +1598,7 @@ static list* bg(list* arg) {
       }
     }
 
-    job = nth_job(i);
+    job = job_get(i);
 
     if (!job) {
       error("esh: bg: invalid job number.");
@@ -1005,25 +1614,34 @@ static list* bg(list* arg) {
 
 
 static list* list_jobs(list* arg) {
-  list* iter;
   job_t* job;
-  int i = 0;
+  int i;
 
   if (fancy_typecheck("", arg, "jobs",
-		      "This command will list all running jobs.")) {
+		      "This command will list all running jobs, with the "
+		      "CPU seconds and\nthe kilobytes of memory used by "
+		      "the processes that are done.")) {
     return NULL;
   }
 
-  printf("No. %-35s %-6s %-6s %-8s\n", "Name", "PID", "PGID", "Status");
+  printf("No. %-35s %-6s %-6s %-8s %7s %8s\n", "Name", "PID", "PGID",
+	 "Status", "CPU", "RSS");
 
-  for (iter = jobs; iter != NULL; iter = ls_next(iter), i++) {
-    job = ls_data(iter);
+  job_reap();
 
-    printf("%-3d %-35s %-6d %-6d %-8s\n", i, job->name, job->last_pid,
-	   job->pgid,
+  for (i = 0; i < job_max(); i++) {
+    job = job_get(i);
+
+    if (!job) continue;
+
+    printf("%-3d %-35s %-6d %-6d %-8s %7.2f %8ld\n", i, job->name,
+	   job->last_pid, job->pgid,
 	   (job->status == JOB_STOPPED ? "Stopped" :
 	    (job->status == JOB_DEAD ? "Dead" :
-	     "Running")));
+	     "Running")),
+	   job->usage.ru_utime.tv_sec + job->usage.ru_stime.tv_sec +
+	   (job->usage.ru_utime.tv_usec + job->usage.ru_stime.tv_usec) / 1e6,
+	   job->usage.ru_maxrss);
   }
 
   return NULL;
@@ -1072,6 +1690,7 @@ static list* define(list* arg) {
   list* copy = NULL;
 
   list* old;
+  memo* m;
 
   if (fancy_typecheck("s*", arg, "define",
 		      "This command will create a new command.\n"
@@ -1092,6 +1711,184 @@ static list* define(list* arg) {
 
   gc_free(copy);
 
+  m = hash_del(memos, ls_data(arg));
+
+  if (m) {
+    memo_free(m);
+  }
+
+  return NULL;
+}
+
+
+static list* define_memo(list* arg) {
+  list* tmp;
+  memo* m;
+  int size, ttl, err1, err2;
+
+  if (fancy_typecheck("sss*", arg, "define-memo",
+		      "This command works like \"define\", except that "
+		      "the new command\nremembers its return values. "
+		      "The second argument is the number of\nreturn "
+		      "values to remember, the third is the number of "
+		      "seconds to\nremember them for. Zero means "
+		      "no limit.\n"
+		      "Example: (define-memo foo 100 60 ~(gobble ...))")) {
+    return NULL;
+  }
+
+  size = do_atoi(ls_data(ls_next(arg)), &err1, 0);
+  ttl = do_atoi(ls_data(ls_next(ls_next(arg))), &err2, 0);
+
+  if (err1 || err2 || size < 0 || ttl < 0) {
+    error("esh: define-memo: the size and time must be numbers.");
+    return NULL;
+  }
+
+  tmp = ls_cons(ls_data(arg), ls_next(ls_next(ls_next(arg))));
+  ls_type_set(tmp, TYPE_STRING);
+
+  define(tmp);
+
+  gc_free(tmp);
+
+  gc_inc_ref(ls_data(arg));
+
+  m = hash_put(memos, ls_data(arg), memo_new(size, ttl));
+
+  if (m) {
+    gc_free(ls_data(arg));
+    memo_free(m);
+  }
+
+  return NULL;
+}
+
+
+static list* profile(list* arg) {
+  char* cmd;
+  list* ret;
+
+  if (fancy_typecheck("s", arg, "profile",
+		      "This command controls the profiler. The argument "
+		      "is one of:\n"
+		      "  start   -- forget the old figures and start "
+		      "profiling,\n"
+		      "  stop    -- stop profiling,\n"
+		      "  report  -- return a table of the time spent in "
+		      "each command,\n"
+		      "  flame   -- return the time spent in each stack "
+		      "of commands, in\n"
+		      "             the format used by flame graph tools.")) {
+    return NULL;
+  }
+
+  cmd = ls_data(arg);
+
+  if (strcmp(cmd, "start") == 0) {
+    profile_start();
+    return NULL;
+
+  } else if (strcmp(cmd, "stop") == 0) {
+    profile_stop();
+    return NULL;
+
+  } else if (strcmp(cmd, "report") == 0) {
+    ret = ls_cons(profile_report(), NULL);
+
+  } else if (strcmp(cmd, "flame") == 0) {
+    ret = ls_cons(profile_flame(), NULL);
+
+  } else {
+    error("esh: profile: unknown command \"%s\".", cmd);
+    return NULL;
+  }
+
+  ls_type_set(ret, TYPE_STRING);
+
+  return ret;
+}
+
+
+static list* trace(list* arg) {
+  char* cmd;
+
+  if (fancy_typecheck("s", arg, "trace",
+		      "This command controls the trace, which remembers "
+		      "the last commands\nrun, processes started and "
+		      "processes waited for. The argument is\n"
+		      "\"start\" or \"stop\". While the trace is on, "
+		      "sending the shell a SIGUSR1\nprints it on the "
+		      "standard error.")) {
+    return NULL;
+  }
+
+  cmd = ls_data(arg);
+
+  if (strcmp(cmd, "start") == 0) {
+    trace_start();
+
+  } else if (strcmp(cmd, "stop") == 0) {
+    trace_stop();
+
+  } else {
+    error("esh: trace: unknown command \"%s\".", cmd);
+  }
+
+  return NULL;
+}
+
+
+static list* trace_dump_cmd(list* arg) {
+  if (arg &&
+      fancy_typecheck("f", arg, "trace-dump",
+		      "This command prints the trace on the given file, "
+		      "or on the\nstandard error if there is no "
+		      "argument.")) {
+    return NULL;
+  }
+
+  if (arg) {
+    trace_dump(((int*)ls_data(arg))[1]);
+
+  } else {
+    trace_dump(STDERR_FILENO);
+  }
+
+  return NULL;
+}
+
+
+static list* memo_clear_cmd(list* arg) {
+  list* keys;
+  list* iter;
+  memo* m;
+
+  if (arg &&
+      fancy_typecheck("S", arg, "memo-clear",
+		      "This command makes commands created with "
+		      "\"define-memo\" forget their\nreturn values. "
+		      "Without arguments, all of them forget.")) {
+    return NULL;
+  }
+
+  if (arg) {
+    keys = ls_copy(arg);
+
+  } else {
+    keys = hash_keys(memos);
+  }
+
+  for (iter = keys; iter != NULL; iter = ls_next(iter)) {
+    m = hash_get(memos, ls_data(iter));
+
+    if (m) {
+      memo_clear(m);
+    }
+  }
+
+  ls_free_all(keys);
+
   return NULL;
 }
 
@@ -1117,8 +1914,6 @@ static list* set_prompt(list* arg) {
 static list* my_if(list* arg) {
   list* iter;
   list* tmp;
-  list* arg_split[3];
-  int i;
 
   if (fancy_typecheck("???", arg, "if",
 		      "If the \"eval\" of the first argument is a "
@@ -1129,30 +1924,16 @@ static list* my_if(list* arg) {
     return NULL;
   }
 
-  arg = ls_copy(arg);
-
-  for (i = 0, iter = arg; iter != NULL; iter = ls_next(iter), i++) {
-
-    arg_split[i] = ls_cons(ls_data(iter), NULL);
-    ls_type_set(arg_split[i], ls_type(iter));
-    ls_flag_set(arg_split[i], ls_flag(iter));
-  }
-
-  ls_free_shallow(arg);
-
-  iter = eval(arg_split[0]);
+  iter = eval_first(arg);
 
   if (iter && ls_type(iter) == TYPE_BOOL && !ls_data(iter)) {
-    tmp = eval(arg_split[2]);
+    tmp = eval_first(ls_next(ls_next(arg)));
 
   } else {
-    tmp = eval(arg_split[1]);
+    tmp = eval_first(ls_next(arg));
   }
 
   ls_free_all(iter);
-  ls_free_all(arg_split[0]);
-  ls_free_all(arg_split[1]);
-  ls_free_all(arg_split[2]);
 
   return tmp;
 }
@@ -1176,8 +1957,6 @@ static list* equal_p(list* arg) {
 
 
 static list* pop(list* arg) {
-  list* foo;
-  list* ret;
 
   if (fancy_typecheck("", arg, "pop",
 		      "This command will pop off a value from the local "
@@ -1185,18 +1964,7 @@ static list* pop(list* arg) {
     return NULL;
   }
 
-  if (!stack) return NULL;
-
-  foo = stack;
-  stack = ls_next(stack);
-
-  ret = ls_cons(ls_data(foo), NULL);
-  ls_type_set(ret, ls_type(foo));
-  ls_flag_set(ret, ls_flag(foo));
-
-  gc_free(foo);
-
-  return ret;
+  return ls_take(&stack);
 }
 
 
@@ -1226,7 +1994,7 @@ static list* top(list* arg) {
     return NULL;
   }
 
-  return car(stack);
+  return borrow(stack, 1);
 }
 
 
@@ -1266,7 +2034,7 @@ static list* my_stack(list* arg) {
     return NULL;
   }
 
-  return ls_copy(stack);
+  return borrow(stack, -1);
 }
 
 
@@ -1461,9 +2229,7 @@ static list* my_parse(list* arg) {
   list* ret;
   int i = 0;
   char* input;
-
-  int len = 128;
-  char* value = (char*)gc_alloc(sizeof(char) * len, "my_parse");
+  token_t tok;
 
 
   if (fancy_typecheck("s", arg, "parse",
@@ -1476,15 +2242,13 @@ static list* my_parse(list* arg) {
 
   ret = parse_builtin(input, &i, 0, 0);
 
-  if (next_token(input, &i, &value, &len)) {
+  if (next_token(input, &i, &tok)) {
     error("esh: extraneous characters after command.");
 
     ls_free_all(ret);
     ret = NULL;
   }
 
-  gc_free(value);
-
   return ret;
 }
 
@@ -1576,7 +2340,7 @@ static list* exec(list* arg) {
     return NULL;
   }
 
-  oldstack = stack;
+  oldstack = ls_move(&stack);
 
   stack = ls_copy(ls_data(arg));
   ret = eval(ls_next(arg));
@@ -1589,6 +2353,7 @@ static list* exec(list* arg) {
 
 static list* rot(list* arg) {
   list* foo;
+  list* bar;
 
   if (fancy_typecheck("", arg, "rot",
 		      "This command switches the top and the next-to-top "
@@ -1599,21 +2364,13 @@ static list* rot(list* arg) {
 
   if (quiet_typecheck("?*", stack)) return NULL;
 
-  foo = stack;
-  stack = ls_next(ls_next(stack));
+  foo = ls_take(&stack);
+  bar = ls_take(&stack);
 
-  stack = ls_cons(ls_data(foo), stack);
-  ls_type_set(stack, ls_type(foo));
-  ls_flag_set(stack, ls_flag(foo));
+  ls_push(&stack, foo);
+  ls_push(&stack, bar);
 
-  stack = ls_cons(ls_data(ls_next(foo)), stack);
-  ls_type_set(stack, ls_type(ls_next(foo)));
-  ls_flag_set(stack, ls_flag(ls_next(foo)));
-
-  gc_free(ls_next(foo));
-  gc_free(foo);
-
-  return car(stack);
+  return borrow(stack, 1);
 }
 
 
@@ -1626,9 +2383,11 @@ static list* list_stack(list* arg) {
     return NULL;
   }
 
-  ret = ls_cons(ls_copy(stack), NULL);
+  ret = ls_cons(stack, NULL);
   ls_type_set(ret, TYPE_LIST);
 
+  result_kind = RESULT_BORROWED;
+
   return ret;
 }
 
@@ -1690,6 +2449,58 @@ static list* my_false(list* arg) {
   return ls_copy(ls_false);
 }
 
+/*
+ * A file in memory with "data" in it, for "file-open string". The
+ * write end appends, and the read end starts at the beginning, with
+ * its own offset. Without memfd_create or /proc, an unlinked temporary
+ * file does the same job.
+ */
+static void string_file(char* data, int* ret) {
+  char path[64];
+  char tmp[] = "/tmp/esh-XXXXXX";
+  int fd = -1;
+
+#ifdef SYS_memfd_create
+  fd = syscall(SYS_memfd_create, "esh-string", 0);
+#endif
+
+  if (fd >= 0) {
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    ret[0] = open(path, O_RDONLY);
+
+    /* Without /proc there is no second offset to be had. */
+    if (ret[0] < 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  if (fd < 0) {
+    fd = mkstemp(tmp);
+
+    if (fd < 0) return;
+
+    ret[0] = open(tmp, O_RDONLY);
+    unlink(tmp);
+  }
+
+  if (ret[0] < 0 || file_write(fd, data) != (long)strlen(data)) {
+    if (ret[0] >= 0) {
+      close(ret[0]);
+    }
+
+    close(fd);
+    ret[0] = -1;
+    return;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_APPEND);
+
+  ret[1] = fd;
+}
+
+
 static list* my_file_open(list* arg) {
   int* ret = (int*)gc_alloc(sizeof(int) * 2, "my_file_open");
 
@@ -1710,7 +2521,9 @@ static list* my_file_open(list* arg) {
 		      "\"append\"   -- Open a regular file for "
 		      "reading/appending.\n"
 		      "\"string\"   -- Simulate a file with a string "
-		      "variable.\n\n"
+		      "variable.\n"
+		      "\"pipe\"     -- Open a pipe, with the name as "
+		      "the first thing in it.\n\n"
 		      "The second argument is either a filename or the "
 		      "initial value of the\nstring buffer.\n"
 		      "This command returns a file, or an empty list "
@@ -1745,6 +2558,10 @@ static list* my_file_open(list* arg) {
     break;
 
   case 's':
+    string_file(name, ret);
+    break;
+
+  case 'p':
     if (pipe(ret) < 0) {
       ret[0] = -1;
       ret[1] = -1;
@@ -1828,24 +2645,30 @@ static list* my_file_read_block(list* arg) {
 static list* my_file_write(list* arg) {
   int* fd;
   int flags;
+  char* decchar;
+  long n;
 
   if (fancy_typecheck("fs", arg, "file-write",
 		      "This command writes the second argument into the "
-		      "first argument.")) {
+		      "first argument,\nand returns the number of bytes "
+		      "written.")) {
     return NULL;
   }
 
   fd = ls_data(arg);
 
-  flags = fcntl(fd[0], F_GETFL);
+  flags = fcntl(fd[1], F_GETFL);
 
   fcntl(fd[1], F_SETFL, flags | O_NONBLOCK);
 
-  file_write(fd[1], ls_data(ls_next(arg)));
+  n = file_write(fd[1], ls_data(ls_next(arg)));
 
   fcntl(fd[1], F_SETFL, flags);
 
-  return NULL;
+  decchar = (char*)gc_alloc(sizeof(char) * 24, "my_file_write");
+  sprintf(decchar, "%ld", n);
+
+  return ls_cons(decchar, NULL);
 }
 
 static list* my_file_type(list* arg) {
@@ -1910,8 +2733,7 @@ static list* standard(list* arg) {
 
 static list* and(list* arg) {
   list* iter;
-  list* tmp1 = NULL;
-  list* tmp2 = NULL;
+  list* tmp = NULL;
 
   if (fancy_typecheck("*", arg, "and",
 		      "This command returns \"false\" if any argument "
@@ -1921,29 +2743,24 @@ static list* and(list* arg) {
   }
 
   for (iter = arg; iter != NULL; iter = ls_next(iter)) {
-    ls_free_all(tmp1);
-    ls_free_all(tmp2);
+    ls_free_all(tmp);
 
-    tmp1 = car(iter);
-    tmp2 = eval(tmp1);
+    tmp = eval_first(iter);
 
-    if (tmp2 && ls_type(tmp2) == TYPE_BOOL && !ls_data(tmp2)) {
-      ls_free_all(tmp1);
-      ls_free_all(tmp2);
+    if (tmp && ls_type(tmp) == TYPE_BOOL && !ls_data(tmp)) {
+      ls_free_all(tmp);
       return ls_copy(ls_false);
     }
   }
 
-  ls_free_all(tmp1);
-  return tmp2;
+  return tmp;
 }
 
 
 
 static list* or(list* arg) {
   list* iter;
-  list* tmp1;
-  list* tmp2;
+  list* tmp;
 
   if (fancy_typecheck("*", arg, "or",
 		      "This command returns \"false\" if all arguments "
@@ -1953,16 +2770,13 @@ static list* or(list* arg) {
   }
 
   for (iter = arg; iter != NULL; iter = ls_next(iter)) {
-    tmp1 = car(iter);
-    tmp2 = eval(tmp1);
+    tmp = eval_first(iter);
 
-    if (!tmp2 || ls_type(tmp2) != TYPE_BOOL || ls_data(tmp2)) {
-      ls_free_all(tmp1);
-      return tmp2;
+    if (!tmp || ls_type(tmp) != TYPE_BOOL || ls_data(tmp)) {
+      return tmp;
     }
 
-    ls_free_all(tmp1);
-    ls_free_all(tmp2);
+    ls_free_all(tmp);
   }
 
   return ls_copy(ls_false);
@@ -1987,8 +2801,7 @@ static list* not(list* arg) {
 
 static list* begin_last(list* arg) {
   list* iter;
-  list* tmp1 = NULL;
-  list* tmp2 = NULL;
+  list* tmp;
 
   if (fancy_typecheck("*", arg, "begin-last",
 		      "This command evaluates the given argument, one "
@@ -1998,16 +2811,13 @@ static list* begin_last(list* arg) {
   }
 
   for (iter = arg; iter != NULL; iter = ls_next(iter)) {
-    tmp1 = car(iter);
-    tmp2 = eval(tmp1);
+    tmp = eval_first(iter);
 
     if (!ls_next(iter)) {
-      ls_free_all(tmp1);
-      return tmp2;
+      return tmp;
     }
 
-    ls_free_all(tmp1);
-    ls_free_all(tmp2);
+    ls_free_all(tmp);
   }
 
   return NULL;
@@ -2062,6 +2872,63 @@ static list* builtin(list* arg) {
 }
 
 
+static list* load_builtins(list* arg) {
+  list* iter;
+
+  if (fancy_typecheck("S", arg, "load-builtins",
+		      "This command loads builtin commands written in C "
+		      "from the given\nshared objects. See esh-plugin.h "
+		      "for how to write one.")) {
+    return NULL;
+  }
+
+  for (iter = arg; iter != NULL; iter = ls_next(iter)) {
+    if (plugin_load(ls_data(iter))) break;
+  }
+
+  return NULL;
+}
+
+
+static list* rehash(list* arg) {
+  if (fancy_typecheck("", arg, "rehash",
+		      "This command makes the shell forget where it has "
+		      "found disk commands,\nso that PATH is searched "
+		      "again. Use it after installing or removing\n"
+		      "programs.")) {
+    return NULL;
+  }
+
+  path_rehash();
+
+  return NULL;
+}
+
+
+static list* which(list* arg) {
+  list* ret = NULL;
+  list* iter;
+  char* file;
+
+  if (fancy_typecheck("S", arg, "which",
+		      "This command returns the files that would be run "
+		      "for the given\ndisk commands. Commands that aren't "
+		      "in PATH are left out.")) {
+    return NULL;
+  }
+
+  for (iter = arg; iter != NULL; iter = ls_next(iter)) {
+    file = path_find(ls_data(iter));
+
+    if (file) {
+      ret = ls_cons(dynamic_strcpy(file), ret);
+    }
+  }
+
+  return ls_reverse(ret);
+}
+
+
 static list* begin(list* arg) {
   return ls_copy(arg);
 }
@@ -2129,6 +2996,180 @@ static list* my_wait(list* arg) {
 }
 
 
+/*
+ * The timeout argument of the "wait-" commands, in milliseconds.
+ */
+static int wait_timeout(list* arg, char* name, long* millis) {
+  int err;
+
+  *millis = do_atoi(ls_data(arg), &err, 0);
+
+  if (err) {
+    error("esh: %s: the timeout should be a number of milliseconds.",
+	  name);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * A fresh node, since it goes into a list.
+ */
+static list* wait_status(int status) {
+  char* decchar;
+  list* ret;
+
+  if (status == JOB_PENDING) {
+    ret = ls_cons((void*)0, NULL);
+    ls_type_set(ret, TYPE_BOOL);
+
+    return ret;
+  }
+
+  decchar = (char*)gc_alloc(sizeof(char) * 12, "wait_status");
+  sprintf(decchar, "%d", status);
+
+  return ls_cons(decchar, NULL);
+}
+
+
+/*
+ * Wait for the processes in "arg" (after the timeout), for "wait-any"
+ * and "wait-all". Returns NULL if interrupted.
+ */
+static int* wait_procs(list* arg, char* name, int all, int* n) {
+  pid_t* pids;
+  int* status;
+  list* iter;
+  long millis;
+  int i;
+
+  if (wait_timeout(arg, name, &millis)) return NULL;
+
+  *n = 0;
+
+  for (iter = ls_next(arg); iter != NULL; iter = ls_next(iter)) {
+    (*n)++;
+  }
+
+  pids = (pid_t*)gc_alloc(sizeof(pid_t) * (*n), "wait_procs");
+  status = (int*)gc_alloc(sizeof(int) * (*n), "wait_procs");
+
+  for (i = 0, iter = ls_next(arg); iter != NULL; i++, iter = ls_next(iter)) {
+    pids[i] = *(pid_t*)ls_data(iter);
+    status[i] = JOB_PENDING;
+  }
+
+  i = job_await(pids, status, *n, all, millis);
+
+  gc_free(pids);
+
+  if (i < 0) {
+    gc_free(status);
+    return NULL;
+  }
+
+  return status;
+}
+
+
+static list* wait_process(list* arg) {
+  pid_t pid;
+  int status = JOB_PENDING;
+  long millis;
+
+  if (fancy_typecheck("sp", arg, "wait-process",
+		      "This command waits for the process to finish, "
+		      "but for no more\nmilliseconds than the first "
+		      "argument; a negative number means no\nlimit. It "
+		      "returns the exit status of the process, or "
+		      "\"false\" if it\ndidn't finish in time.")) {
+    return NULL;
+  }
+
+  if (wait_timeout(arg, "wait-process", &millis)) return NULL;
+
+  pid = *(pid_t*)ls_data(ls_next(arg));
+
+  if (job_await(&pid, &status, 1, 1, millis) < 0) return NULL;
+
+  return wait_status(status);
+}
+
+
+static list* wait_any(list* arg) {
+  list* ret;
+  char* num;
+  int* status;
+  int n, i;
+
+  if (fancy_typecheck("sP", arg, "wait-any",
+		      "This command is like \"wait-process\", but waits "
+		      "for the first of\nthe processes to finish. It "
+		      "returns a list of the number of that\nprocess, "
+		      "counting from 0, and its exit status; or \"false\" "
+		      "if none\nof them finished in time.")) {
+    return NULL;
+  }
+
+  status = wait_procs(arg, "wait-any", 0, &n);
+
+  if (!status) return NULL;
+
+  for (i = 0; i < n && status[i] == JOB_PENDING; i++) {
+    /* Nothing. */
+  }
+
+  if (i == n) {
+    ret = wait_status(JOB_PENDING);
+
+  } else {
+    num = (char*)gc_alloc(sizeof(char) * 12, "wait_any");
+    sprintf(num, "%d", i);
+
+    ret = ls_cons(ls_cons(num, wait_status(status[i])), NULL);
+    ls_type_set(ret, TYPE_LIST);
+  }
+
+  gc_free(status);
+
+  return ret;
+}
+
+
+static list* wait_all(list* arg) {
+  list* ret = NULL;
+  list* last = NULL;
+  int* status;
+  int n, i;
+
+  if (fancy_typecheck("sP", arg, "wait-all",
+		      "This command is like \"wait-process\", but waits "
+		      "for all of the\nprocesses to finish. It returns "
+		      "a list of their exit statuses, with\n\"false\" for "
+		      "each process that didn't finish in time.")) {
+    return NULL;
+  }
+
+  status = wait_procs(arg, "wait-all", 1, &n);
+
+  if (!status) return NULL;
+
+  for (i = 0; i < n; i++) {
+    ls_append(&ret, &last, wait_status(status[i]));
+  }
+
+  gc_free(status);
+
+  ret = ls_cons(ret, NULL);
+  ls_type_set(ret, TYPE_LIST);
+
+  return ret;
+}
+
+
 static list* alive_p(list* arg) {
   pid_t foo;
   char buff[255];
@@ -2156,8 +3197,6 @@ static list* alive_p(list* arg) {
 
 
 static list* my_while(list* arg) {
-  list* cond;
-  list* act;
   list* foo;
   list* oldstack;
 
@@ -2173,15 +3212,12 @@ static list* my_while(list* arg) {
     return NULL;
   }
 
-  oldstack = stack;
+  oldstack = ls_move(&stack);
 
   stack = ls_copy(ls_next(ls_next(arg)));
 
-  cond = car(arg);
-  act = car(ls_next(arg));
-
   while (1) {
-    foo = eval(cond);
+    foo = eval_first(arg);
 
     if (exception_flag ||
 	(foo && ls_type(foo) == TYPE_BOOL && !ls_data(foo))) {
@@ -2191,12 +3227,10 @@ static list* my_while(list* arg) {
     }
 
     ls_free_all(foo);
-    ls_free_all(eval(act));
+    ls_free_all(eval_first(ls_next(arg)));
   }
 
   ls_free_all(stack);
-  ls_free_all(cond);
-  ls_free_all(act);
   stack = oldstack;
 
   return NULL;
@@ -2378,6 +3412,257 @@ static list* filter(list* arg) {
 }
 
 
+/*
+ * The iteration commands. Each element of the list (or each line of the
+ * stream) is put on top of the stack in turn, and the body is evaluated.
+ * The stack frame is a single
+ * node that gets reused for every element; it holds an extra reference,
+ * so that it survives the body popping it off the stack, and it is only
+ * replaced if the body decides to keep it.
+ */
+
+#define ITER_EACH   0
+#define ITER_MAP    1
+#define ITER_KEEP   2
+#define ITER_FOLD   3
+
+static list* iterate(list* src, list* code, list* init, int what) {
+  list* oldstack;
+  list* ret = NULL;
+  list* last = NULL;
+  list* acc = NULL;
+  list* frame;
+  list* iter = NULL;
+  list* i0;
+  list* cur;
+  list* tmp;
+  list* nw;
+  char* line;
+
+  if (ls_type(src) == TYPE_LIST) {
+    iter = ls_data(src);
+
+  } else if (ls_type(src) != TYPE_STREAM) {
+    error("esh: the first argument must be a list or a stream.");
+    return NULL;
+  }
+
+  oldstack = ls_move(&stack);
+
+  for (i0 = init; i0 != NULL; i0 = ls_next(i0)) {
+    nw = ls_cons(ls_data(i0), NULL);
+    ls_type_set(nw, ls_type(i0));
+    ls_flag_set(nw, ls_flag(i0));
+
+    ls_append(&acc, &last, nw);
+  }
+
+  ls_claim(acc);
+  last = NULL;
+
+  frame = ls_cons(NULL, NULL);
+
+  while (!exception_flag) {
+    if (ls_type(src) == TYPE_STREAM) {
+      line = stream_line(ls_data(src));
+
+      if (!line) break;
+
+      cur = ls_cons(line, NULL);
+
+    } else {
+      if (!iter) break;
+
+      cur = iter;
+      iter = ls_next(iter);
+    }
+
+    ls_data_set(frame, ls_data(cur));
+    ls_type_set(frame, ls_type(cur));
+    ls_flag_set(frame, ls_flag(cur));
+
+    ls_push(&stack, frame);
+    ls_claim(stack);
+
+    if (what == ITER_FOLD) {
+      stack = acc;
+      ls_push(&stack, frame);
+    }
+
+    gc_inc_ref(frame);
+
+    tmp = eval_first(code);
+
+    ls_free_all(stack);
+    stack = NULL;
+
+    if (gc_refs(frame) > 1) {
+      gc_free(frame);
+      frame = ls_cons(NULL, NULL);
+    }
+
+    switch (what) {
+    case ITER_EACH:
+      ls_free_all(tmp);
+      break;
+
+    case ITER_MAP:
+      while (tmp) {
+	nw = ls_take(&tmp);
+
+	if (ls_type(nw) == TYPE_VOID) {
+	  gc_free(nw);
+	  continue;
+	}
+
+	ls_append(&ret, &last, nw);
+      }
+      break;
+
+    case ITER_KEEP:
+      if (!tmp || ls_type(tmp) != TYPE_BOOL || ls_data(tmp)) {
+	nw = ls_cons(ls_data(cur), NULL);
+	ls_type_set(nw, ls_type(cur));
+	ls_flag_set(nw, ls_flag(cur));
+
+	ls_append(&ret, &last, ls_claim(nw));
+      }
+
+      ls_free_all(tmp);
+      break;
+
+    case ITER_FOLD:
+      acc = tmp;
+      break;
+    }
+
+    if (ls_type(src) == TYPE_STREAM) {
+      ls_free_all(cur);
+    }
+  }
+
+  gc_free(frame);
+
+  stack = oldstack;
+
+  if (what == ITER_FOLD) {
+    return acc;
+
+  } else {
+    ls_free_all(acc);
+    return ret;
+  }
+}
+
+
+static list* each(list* arg) {
+  if (fancy_typecheck("?l", arg, "each",
+		      "This command evaluates the second argument once "
+		      "for every element\nof the first argument, with "
+		      "the element on top of the stack.\n"
+		      "The first argument can be a list or a stream.\n"
+		      "The return values are thrown away.")) {
+    return NULL;
+  }
+
+  return iterate(arg, ls_next(arg), NULL, ITER_EACH);
+}
+
+
+static list* for_each(list* arg) {
+  list* ret = NULL;
+  list* last = NULL;
+  list* iter;
+  list* elem;
+  list* call;
+  list* tmp;
+  list* nw;
+
+  if (fancy_typecheck("s*", arg, "for-each",
+		      "This command runs the command named by the first "
+		      "argument once for\nevery other argument, with that "
+		      "argument. A list argument stands for\nits "
+		      "elements. All the return values are returned.\n"
+		      "Example: (for-each print foo ~(bar baz))")) {
+    return NULL;
+  }
+
+  for (iter = ls_next(arg); iter != NULL; iter = ls_next(iter)) {
+    elem = (ls_type(iter) == TYPE_LIST ? ls_data(iter) : iter);
+
+    while (elem && !exception_flag) {
+      /* Argument lists only borrow their values; see "eval_aux". */
+      call = ls_cons(ls_data(arg), ls_cons(ls_data(elem), NULL));
+      ls_type_set(call, TYPE_STRING);
+      ls_type_set(ls_next(call), ls_type(elem));
+      ls_flag_set(ls_next(call), ls_flag(elem));
+
+      tmp = do_builtin(call);
+
+      gc_free(ls_next(call));
+      gc_free(call);
+
+      while (tmp) {
+	nw = ls_take(&tmp);
+
+	if (ls_type(nw) == TYPE_VOID) {
+	  gc_free(nw);
+	  continue;
+	}
+
+	ls_append(&ret, &last, nw);
+      }
+
+      elem = (ls_type(iter) == TYPE_LIST ? ls_next(elem) : NULL);
+    }
+  }
+
+  return ret;
+}
+
+
+static list* map(list* arg) {
+  if (fancy_typecheck("?l", arg, "map",
+		      "This command evaluates the second argument once "
+		      "for every element\nof the first argument, with "
+		      "the element on top of the stack, and\nreturns "
+		      "all the return values.")) {
+    return NULL;
+  }
+
+  return iterate(arg, ls_next(arg), NULL, ITER_MAP);
+}
+
+
+static list* keep(list* arg) {
+  if (fancy_typecheck("?l", arg, "keep",
+		      "This command returns the elements of the first "
+		      "argument for which\nthe \"eval\" of the second "
+		      "argument is not \"false\".\n"
+		      "The element being tested is on top of the stack.")) {
+    return NULL;
+  }
+
+  return iterate(arg, ls_next(arg), NULL, ITER_KEEP);
+}
+
+
+static list* fold(list* arg) {
+  if (fancy_typecheck("?l*", arg, "fold",
+		      "This command evaluates the second argument once "
+		      "for every element\nof the first argument. The "
+		      "stack holds the element on top of the\nreturn "
+		      "value of the previous evaluation; the rest of the "
+		      "arguments\nare used the first time around.\n"
+		      "The last return value is returned.\n"
+		      "Example: (fold ~(1 2 3) ~(+ (pop) (pop)) 0) => 6")) {
+    return NULL;
+  }
+
+  return iterate(arg, ls_next(arg), ls_next(ls_next(arg)), ITER_FOLD);
+}
+
+
 static list* my_clone(list* arg) {
   list* ret = NULL;
   char* foo;
@@ -2582,6 +3867,9 @@ hash_entry builtins_array[] = {
   { "stderr-handler", stderr_handler },
   { "wait",      my_wait },
   { "alive?",    alive_p },
+  { "wait-process", wait_process },
+  { "wait-any",  wait_any },
+  { "wait-all",  wait_all },
   { "while",     my_while },
   { "alias-hash", alias_hash },
   { "car-l",     my_car_l },
@@ -2599,6 +3887,100 @@ hash_entry builtins_array[] = {
   { ">",         greater_than },
   { "void",      my_void },
   { "repeat",    repeat },
+  { "define-memo", define_memo },
+  { "memo-clear",  memo_clear_cmd },
+  { "each",      each },
+  { "for-each",  for_each },
+  { "map",       map },
+  { "keep",      keep },
+  { "fold",      fold },
+  { "profile",   profile },
+  { "trace",     trace },
+  { "trace-dump", trace_dump_cmd },
+  { "with-budget", with_budget },
+  { "time",      my_time },
+  { "stream",    stream },
+  { "stream-next", stream_next },
+  { "stream-lines", stream_lines },
+  { "stream-eof?", stream_eof_p },
+  { "coproc",    coproc },
+  { "coproc-send", coproc_send_cmd },
+  { "coproc-recv-line", coproc_recv_line },
+  { "coproc-close", coproc_close_cmd },
+  { "load-builtins", load_builtins },
+  { "rehash",    rehash },
+  { "which",     which },
+  { "parallel",  parallel },
   { NULL, NULL }
 };
 
+
+
+/*
+ * Builtins that never run any shell code, and so can be given values
+ * borrowed from the stack as arguments. See builtins.h.
+ */
+
+hash_entry borrowers_array[] = {
+  { "cd",     cd },
+  { "copy",   ls_copy },
+  { "set",    set },
+  { "get",    get },
+  { "alias",  alias },
+  { "+",      plus },
+  { "*",      times },
+  { "-",      minus },
+  { "/",      over },
+  { "define", define },
+  { "define-memo", define_memo },
+  { "memo-clear",  memo_clear_cmd },
+  { "profile",   profile },
+  { "trace",     trace },
+  { "trace-dump", trace_dump_cmd },
+  { "stream-next", stream_next },
+  { "stream-lines", stream_lines },
+  { "stream-eof?", stream_eof_p },
+  { "coproc-send", coproc_send_cmd },
+  { "coproc-recv-line", coproc_recv_line },
+  { "coproc-close", coproc_close_cmd },
+  { "rehash",    rehash },
+  { "which",     which },
+  { "prompt", set_prompt },
+  { "=",      equal_p },
+  { "push",   push },
+  { "list",   my_list },
+  { "print",  my_print },
+  { "hash-get",  my_hash_get },
+  { "hash-put",  my_hash_put },
+  { "hash-keys", my_hash_keys },
+  { "car",       my_car },
+  { "first",     my_car },
+  { "cdr",       cdr },
+  { "rest",      cdr },
+  { "squish",    squish },
+  { "typecheck", my_typecheck },
+  { "split",     split },
+  { "unlist",    unlist },
+  { "begin",     begin },
+  { "defined?",  defined_p },
+  { "file-open", my_file_open },
+  { "file-write", my_file_write },
+  { "file-type", my_file_type },
+  { "not",       not },
+  { "null?",     my_null_p },
+  { "not-null?", my_not_null_p },
+  { "l-cdr",     list_cdr },
+  { "l-rest",    list_cdr },
+  { "car-l",     my_car_l },
+  { "first-l",   my_car_l },
+  { "chop!",     chop },
+  { "chop-nl!",  chop_nl },
+  { "match",     match },
+  { "reverse",   reverse },
+  { "chars",     chars },
+  { "clone",     my_clone },
+  { "substring?", substring_p },
+  { "<",         less_than },
+  { ">",         greater_than },
+  { NULL, NULL }
+};
@@ -7,9 +7,28 @@
 #ifndef __builtins_h__
 #define __builtins_h__
 
+/*
+ * Builtins normally return lists that belong to the caller. A builtin
+ * can instead return fresh nodes that only borrow their data from the
+ * stack, by setting "result_kind" to RESULT_BORROWED right before
+ * returning. "do_builtin" always gives out owned lists; the evaluator
+ * passes borrowed values straight on to the builtins listed in
+ * "borrowers_array", which never run shell code (and so cannot pop
+ * the stack from under their arguments).
+ */
+
+#define RESULT_OWNED     0
+#define RESULT_BORROWED  1
+
+extern int result_kind;
+
 extern hash_entry builtins_array[];
+extern hash_entry borrowers_array[];
 
 extern list* eval(list* arg);
+extern list* eval_first(list* arg);
+extern int fancy_typecheck(char* tspec, list* arg,
+			   char* cmdname, char* cmddesc);
 extern void register_chdir(void);
 
 #endif /* !__builtins_h__ */
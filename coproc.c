@@ -0,0 +1,237 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "format.h"
+#include "list.h"
+#include "gc.h"
+#include "hash.h"
+#include "job.h"
+#include "token.h"
+#include "esh.h"
+#include "coproc.h"
+
+
+coproc_t* coproc_new(list* ls) {
+  coproc_t* c;
+  int to[2];
+  int from[2];
+  pid_t pid;
+
+  if (pipe(to)) {
+    error("esh: coproc: could not create a pipe.");
+    return NULL;
+  }
+
+  if (pipe(from)) {
+    close(to[0]);
+    close(to[1]);
+
+    error("esh: coproc: could not create a pipe.");
+    return NULL;
+  }
+
+  fcntl(to[0], F_SETFD, 1);
+  fcntl(to[1], F_SETFD, 1);
+  fcntl(from[0], F_SETFD, 1);
+  fcntl(from[1], F_SETFD, 1);
+
+  pid = do_pipe(to[0], from[1], ls, 1, 1);
+
+  close(to[0]);
+
+  if (pid <= 0) {
+    close(to[1]);
+    close(from[0]);
+
+    return NULL;
+  }
+
+  c = (coproc_t*)gc_alloc(sizeof(coproc_t), "coproc_new");
+
+  c->last_pid = pid;
+  c->pgid = 0;
+  c->fd = to[1];
+  c->len = 0;
+
+  stream_init(&c->in, from[0]);
+
+  /* Keep the exit status, even if the job table reaps it first. */
+  job_expect(pid);
+
+  if (interactive) {
+    c->pgid = job_by_pid(pid)->pgid;
+  }
+
+  return c;
+}
+
+
+static int coproc_write(int fd, char* data, int n) {
+  sig_t oldsig;
+  int ret = 0;
+  int m;
+
+  /* A coprocess that quit should be an error, not the end of us. */
+  oldsig = signal(SIGPIPE, SIG_IGN);
+
+  while (n > 0) {
+    m = write(fd, data, n);
+
+    if (m < 0 && errno == EINTR) continue;
+
+    if (m <= 0) {
+      ret = -1;
+      break;
+    }
+
+    data += m;
+    n -= m;
+  }
+
+  signal(SIGPIPE, oldsig);
+
+  return ret;
+}
+
+
+static int coproc_flush(coproc_t* c) {
+  int ret = 0;
+
+  if (c->len && c->fd >= 0) {
+    ret = coproc_write(c->fd, c->data, c->len);
+  }
+
+  c->len = 0;
+
+  return ret;
+}
+
+
+int coproc_send(coproc_t* c, char* data, int n) {
+
+  if (c->fd < 0) return -1;
+
+  if (c->len + n > COPROC_BLOCK) {
+    if (coproc_flush(c)) return -1;
+  }
+
+  if (n >= COPROC_BLOCK) {
+    return coproc_write(c->fd, data, n);
+  }
+
+  memcpy(c->data + c->len, data, n);
+  c->len += n;
+
+  return 0;
+}
+
+
+char* coproc_line(coproc_t* c) {
+  coproc_flush(c);
+
+  return stream_line(&c->in);
+}
+
+
+/*
+ * Throw away the rest of the output, unless interrupted.
+ */
+static void coproc_drain(coproc_t* c) {
+  struct pollfd pfd;
+  int n;
+
+  pfd.fd = c->in.fd;
+  pfd.events = POLLIN;
+
+  while (c->in.fd >= 0 && !exception_flag) {
+    pfd.revents = 0;
+
+    /* Unlike "read", this doesn't get restarted after a signal. */
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    n = read(c->in.fd, c->data, COPROC_BLOCK);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+  }
+}
+
+
+int coproc_close(coproc_t* c) {
+  struct rusage ru;
+  job_t* job = NULL;
+  int status = JOB_PENDING;
+  int tmp;
+
+  coproc_flush(c);
+
+  if (c->fd >= 0) {
+    close(c->fd);
+  }
+
+  c->fd = -1;
+
+  coproc_drain(c);
+  stream_close(&c->in);
+
+  if (c->last_pid <= 0) return -1;
+
+  if (interactive) {
+    job = job_by_pid(c->last_pid);
+  }
+
+  job_await(&c->last_pid, &status, 1, 1, -1);
+
+  if (status == JOB_PENDING) {
+    /* Interrupted; don't leave it running. */
+    kill((c->pgid > 0 ? -c->pgid : c->last_pid), SIGTERM);
+
+  } else if (c->pgid > 0) {
+    /* The rest of the pipeline. */
+    kill(-c->pgid, SIGPIPE);
+
+    while (wait4(-c->pgid, &tmp, 0, &ru) > 0) {
+      job_account(job, &ru);
+    }
+  }
+
+  job_forget(c->last_pid);
+  c->last_pid = 0;
+
+  return (status == JOB_PENDING ? -1 : status);
+}
+
+
+void coproc_hangup(coproc_t* c) {
+  coproc_flush(c);
+
+  if (c->last_pid > 0) {
+    job_forget(c->last_pid);
+  }
+
+  if (c->fd >= 0) {
+    close(c->fd);
+  }
+
+  c->fd = -1;
+
+  stream_close(&c->in);
+}
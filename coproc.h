@@ -0,0 +1,57 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __coproc_h__
+#define __coproc_h__
+
+#include "stream.h"
+
+/*
+ * A coprocess is a pipeline that keeps running in the background,
+ * with a pipe to its input and another from its output. Lines are
+ * sent to it and read back one at a time, so talking to a helper
+ * many times costs a write and a read instead of a new process.
+ * It is the data of a TYPE_COPROC list node, and shared between
+ * copies of the node.
+ *
+ * Pitfalls:
+ *
+ *  + "coproc_send" only buffers; the buffer is written out when it
+ *    fills up, before every "coproc_line", and when the coprocess is
+ *    closed. The coprocess has to flush its own output a line at a
+ *    time, or "coproc_line" will wait for it forever.
+ *  + "coproc_line" returns NULL at the end of the output, like
+ *    "stream_line".
+ *  + "coproc_close" closes the input, throws away the rest of the
+ *    output and waits for the pipeline to quit. It returns the exit
+ *    status, 128 plus the signal number if the pipeline was killed,
+ *    or -1 if the status is not known any more. If it is interrupted
+ *    while the output goes on, the pipeline gets a SIGTERM.
+ *  + "coproc_hangup" is for the last reference: it closes both pipes
+ *    without waiting, the job table takes care of the rest.
+ *  + Both of these leave the structure for the caller to free.
+ */
+
+#define COPROC_BLOCK   4096
+
+typedef struct coproc_t coproc_t;
+
+struct coproc_t {
+  pid_t pgid;
+  pid_t last_pid;
+  int fd;
+  int len;
+  stream_t in;
+  char data[COPROC_BLOCK];
+};
+
+extern coproc_t* coproc_new(list* ls);
+extern int coproc_send(coproc_t* c, char* data, int n);
+extern char* coproc_line(coproc_t* c);
+extern int coproc_close(coproc_t* c);
+extern void coproc_hangup(coproc_t* c);
+
+#endif /* !__coproc_h__ */
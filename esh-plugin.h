@@ -0,0 +1,90 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __esh_plugin_h__
+#define __esh_plugin_h__
+
+#include <stddef.h>
+
+/*
+ * The interface for builtins written in C and loaded at run time with
+ * "load-builtins". This is the only esh header a plugin needs.
+ *
+ * A plugin is a shared object that defines
+ *
+ *     int esh_plugin_init(esh_api* api);
+ *
+ * which is called once, right after the object is loaded. It should
+ * check "api->version", register its commands with "api->add_builtin"
+ * and return 0. Anything else makes "load-builtins" fail.
+ *
+ * Pitfalls:
+ *
+ *  + Everything the plugin needs from esh goes through "api"; the
+ *    plugin must not call esh functions directly. Keep the pointer.
+ *  + The list structure is opaque here. The ESH_TYPE_* values are the
+ *    same as the TYPE_* values in list.h.
+ *  + A builtin gets a list of arguments that it does not own, and
+ *    returns a list that belongs to the caller (or NULL). Strings in
+ *    returned lists must come from "api->alloc". "api->ls_true",
+ *    "api->ls_false" and "api->ls_void" are returned with "api->copy".
+ *  + Builtins registered with ESH_BORROWS may be handed values that
+ *    are borrowed from the stack. Only use the flag for builtins that
+ *    keep nothing of their arguments past the call.
+ *  + Names that are already builtins cannot be registered again.
+ *  + Plugins are never unloaded.
+ */
+
+#define ESH_PLUGIN_VERSION  1
+#define ESH_PLUGIN_INIT     "esh_plugin_init"
+
+#define ESH_TYPE_STRING   0
+#define ESH_TYPE_LIST     1
+#define ESH_TYPE_HASH     2
+#define ESH_TYPE_BOOL     3
+#define ESH_TYPE_FD       4
+#define ESH_TYPE_PROC     5
+#define ESH_TYPE_VOID     6
+#define ESH_TYPE_STREAM   7
+#define ESH_TYPE_COPROC   8
+
+#define ESH_BORROWS       1
+
+#ifndef __list_h__
+typedef struct list list;
+#endif
+
+typedef list* (*esh_builtin)(list* arg);
+
+typedef struct esh_api esh_api;
+
+struct esh_api {
+  int version;
+
+  int (*add_builtin)(char* name, esh_builtin func, int flags);
+  int (*typecheck)(char* tspec, list* arg, char* cmdname, char* cmddesc);
+  void (*error)(const char* fmt, ...);
+
+  list* (*cons)(void* data, list* ls);
+  list* (*next)(list* ls);
+  void* (*data)(list* ls);
+  char (*type)(list* ls);
+  void (*type_set)(list* ls, char type);
+  list* (*copy)(list* ls);
+  void (*free_all)(list* ls);
+
+  void* (*alloc)(size_t size, char* where);
+  void (*inc_ref)(void* ptr);
+  void (*free)(void* ptr);
+
+  list* ls_true;
+  list* ls_false;
+  list* ls_void;
+};
+
+extern int esh_plugin_init(esh_api* api);
+
+#endif /* !__esh_plugin_h__ */
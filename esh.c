@@ -7,6 +7,7 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <fcntl.h>
 
@@ -19,15 +20,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
 
 #include <glob.h>
+#include <spawn.h>
+#include <poll.h>
 
 #include "common.h"
 #include "format.h"
 #include "list.h"
 #include "gc.h"
 #include "hash.h"
+#include "memo.h"
+#include "profile.h"
+#include "trace.h"
+#include "budget.h"
+#include "stream.h"
+#include "coproc.h"
+#include "plugin.h"
+#include "path.h"
+#include "native.h"
 #include "job.h"
+#include "token.h"
+#include "esh.h"
 #include "builtins.h"
 #include "read.h"
 
@@ -42,10 +57,11 @@ int exception_flag = 0;
 struct termios shell_terminal_modes;
 
 hash_table* builtins;
+hash_table* borrowers;
 hash_table* aliases;
 hash_table* defines;
+hash_table* memos;
 
-list* jobs = NULL;
 list* prompt = NULL;
 list* stack = NULL;
 list* ls_true = NULL;
@@ -137,6 +153,19 @@ char* dynamic_strcpy(char* str) {
   return tmp;
 }
 
+/*
+ * Make a string out of a token slice. The string is sized exactly.
+ */
+char* token_strcpy(char* input, token_t* tok) {
+  char* tmp = (char*)gc_alloc(sizeof(char) * (tok->len + 1),
+			      "token_strcpy");
+
+  memcpy(tmp, input + tok->start, tok->len);
+  tmp[tok->len] = '\0';
+
+  return tmp;
+}
+
 
 /*
  * The tokenizer. Useful, but quite limited. It does not detect numerals
@@ -150,12 +179,13 @@ char* dynamic_strcpy(char* str) {
  * done because numerals are needed so infrequently.
  */
 
-char next_token(char* input, int* i, char** token_value, int* len) {
+char next_token(char* input, int* i, token_t* tok) {
   char ret, foo;
   int currquote = 0;
   int do_write = 0;
-  int ignore = 0;
-  int j = 0;
+
+  tok->start = *i;
+  tok->len = 0;
 
   if (!input || !input[*i]) {
     return '\0';
@@ -164,21 +194,27 @@ char next_token(char* input, int* i, char** token_value, int* len) {
   while (1) {
     foo = input[*i];
 
-    if (ignore) {
-      if (foo == '\n' || !foo) {
-	ignore = 0;
-      }
-    }
-
     /* Are we currently in a quote? */
-    if (!ignore && quote(foo)) {
+    if (quote(foo)) {
       if (do_write) {
 	ret = 'a';
 	break;
 
       } else if (!currquote) {
+	char stop[2];
+
 	currquote = quote(foo);
 
+	/* Jump straight to the closing quote. */
+	stop[0] = foo;
+	stop[1] = '\0';
+
+	(*i)++;
+	tok->start = *i;
+	tok->len = strcspn(input + (*i), stop);
+	(*i) += tok->len;
+	continue;
+
       } else if (currquote == quote(foo)) {
 	ret = 'a';
 	(*i)++;
@@ -198,25 +234,27 @@ char next_token(char* input, int* i, char** token_value, int* len) {
     }
 
     /* Handle comments. */
-    if (!ignore && comment(foo) && !currquote) {
+    if (comment(foo) && !currquote) {
       if (do_write) {
 	ret = 'a';
 	break;
 
       } else {
-	ignore = 1;
+	/* Jump straight to the end of the line. */
+	(*i) += strcspn(input + (*i), "\n");
+	continue;
       }
     }
 
     /* Stop at special syntax. */
-    if (!ignore && special(foo) && !quote(foo) && !currquote && !do_write) {
+    if (special(foo) && !quote(foo) && !currquote && !do_write) {
       (*i)++;
       ret = foo;
       break;
     }
 
     /* Find a word beginning. */
-    if (!ignore && !currquote) {
+    if (!currquote) {
 
       /* It's a letter. */
       if (!blank(foo) && !special(foo)) {
@@ -245,25 +283,15 @@ char next_token(char* input, int* i, char** token_value, int* len) {
 
     (*i)++;
 
-    if (do_write || (currquote && currquote != quote(foo))) {
-      if (j == (*len)-2) {
-	char* tmp = (char*)gc_alloc(sizeof(char) * (*len) * 2,
-				    "next_token");
-
-	(*token_value)[(*len)-1] = '\0';
-	strcpy(tmp, (*token_value));
-
-	gc_free(*token_value);
-	(*token_value) = tmp;
-	(*len) *= 2;
+    if (do_write) {
+      if (!tok->len) {
+	tok->start = (*i)-1;
       }
 
-      (*token_value)[j++] = foo;
+      tok->len++;
     }
   }
 
-  (*token_value)[j] = '\0';
-
   if (!ret && currquote) {
     error("esh: parse error: end of input while looking for "
 	  "a closing quote.");
@@ -317,20 +345,184 @@ char* ls_strcat(list* ls) {
 }
 
 
-glob_t* globbify(list* command) {
-  glob_t* ret = (glob_t*)gc_alloc(sizeof(glob_t), "globbify");
+/*
+ * The command line of a disk command, as given to "execve". Every
+ * string holds a reference of its own.
+ */
+typedef struct argv_t argv_t;
+
+struct argv_t {
+  int argc;
+  int size;
+  char** argv;
+};
+
+/*
+ * What literal aliases expand to. "src" is the alias the words were
+ * made from; holding a reference to it means that as long as the alias
+ * is the same list, the words are still good.
+ */
+typedef struct alias_argv alias_argv;
+
+struct alias_argv {
+  list* src;
+  argv_t words;
+};
+
+static hash_table* alias_argvs = NULL;
+
+
+static void argv_add(argv_t* a, char* str) {
+  if (a->argc + 1 >= a->size) {
+    char** tmp;
+
+    a->size = (a->size ? a->size * 2 : 16);
+    tmp = (char**)gc_alloc(sizeof(char*) * a->size, "argv_add");
+
+    if (a->argv) {
+      memcpy(tmp, a->argv, sizeof(char*) * a->argc);
+      gc_free(a->argv);
+    }
+
+    a->argv = tmp;
+  }
+
+  a->argv[a->argc++] = str;
+  a->argv[a->argc] = NULL;
+}
+
+
+static void argv_free(argv_t* a) {
+  int i;
+
+  for (i = 0; i < a->argc; i++) {
+    gc_free(a->argv[i]);
+  }
+
+  if (a->argv) {
+    gc_free(a->argv);
+  }
+
+  a->argc = 0;
+  a->size = 0;
+  a->argv = NULL;
+}
+
+
+/*
+ * Words without wildcards (or backslashes, which glob treats as
+ * escapes) are what they are; no need to ask "glob".
+ */
+static int argv_literal(char* word) {
+  return (strpbrk(word, "*?[\\") == NULL);
+}
+
+
+static void argv_word(argv_t* a, char* word) {
+  glob_t g;
+  int i;
+
+  if (argv_literal(word)) {
+    gc_inc_ref(word);
+    argv_add(a, word);
+    return;
+  }
+
+  if (glob(word, GLOB_NOCHECK, NULL, &g) != 0) {
+    gc_inc_ref(word);
+    argv_add(a, word);
+    return;
+  }
+
+  for (i = 0; i < g.gl_pathc; i++) {
+    argv_add(a, dynamic_strcpy(g.gl_pathv[i]));
+  }
+
+  globfree(&g);
+}
+
+
+static void argv_alias(argv_t* a, char* name, list* alias) {
+  alias_argv* cache;
+  list* iter;
+  int i;
+
+  if (!alias_argvs) {
+    alias_argvs = (hash_table*)gc_alloc(sizeof(hash_table), "argv_alias");
+    hash_init(alias_argvs, NULL);
+  }
+
+  cache = hash_get(alias_argvs, name);
+
+  if (!cache || cache->src != alias) {
+
+    for (iter = alias; iter != NULL; iter = ls_next(iter)) {
+      if (!argv_literal(ls_data(iter))) break;
+    }
+
+    if (iter) {
+      /* Wildcards; the expansion depends on the directory. */
+      for (iter = alias; iter != NULL; iter = ls_next(iter)) {
+	argv_word(a, ls_data(iter));
+      }
+
+      return;
+    }
+
+    if (!cache) {
+      cache = (alias_argv*)gc_alloc(sizeof(alias_argv), "argv_alias");
+      cache->src = NULL;
+      cache->words.argc = 0;
+      cache->words.size = 0;
+      cache->words.argv = NULL;
+
+      hash_put(alias_argvs, dynamic_strcpy(name), cache);
+
+    } else {
+      ls_free_all(cache->src);
+      argv_free(&(cache->words));
+    }
+
+    cache->src = ls_copy(alias);
+
+    for (iter = alias; iter != NULL; iter = ls_next(iter)) {
+      argv_word(&(cache->words), ls_data(iter));
+    }
+  }
+
+  for (i = 0; i < cache->words.argc; i++) {
+    gc_inc_ref(cache->words.argv[i]);
+    argv_add(a, cache->words.argv[i]);
+  }
+}
+
+
+#ifdef MEM_DEBUG
+static void alias_argv_free(alias_argv* cache) {
+  ls_free_all(cache->src);
+  argv_free(&(cache->words));
+  gc_free(cache);
+}
+#endif
+
+
+argv_t* globbify(list* command) {
+  argv_t* ret;
 
-  int flags = GLOB_NOCHECK;
   list* iter;
   list* alias;
 
   list* junk = NULL;
 
   if (!command) {
-    gc_free(ret);
     return NULL;
   }
 
+  ret = (argv_t*)gc_alloc(sizeof(argv_t), "globbify");
+  ret->argc = 0;
+  ret->size = 0;
+  ret->argv = NULL;
+
   alias = hash_get(aliases, ls_data(command));
 
   if (alias) {
@@ -338,17 +530,11 @@ glob_t* globbify(list* command) {
       alias = NULL;
 
     } else {
+      argv_alias(ret, ls_data(command), alias);
       command = ls_next(command);
     }
   }
 
-  for (iter = alias; iter != NULL; iter = ls_next(iter)) {
-
-    glob(ls_data(iter), flags, NULL, ret);
-
-    flags |= GLOB_APPEND;
-  }
-
   for (iter = command; iter != NULL; iter = ls_next(iter)) {
 
     if (ls_type(iter) == TYPE_LIST) {
@@ -359,15 +545,13 @@ glob_t* globbify(list* command) {
     if (ls_type(iter) != TYPE_STRING) {
       error("esh: disk commands should be given as lists of strings.");
 
-      globfree(ret);
+      argv_free(ret);
       gc_free(ret);
       ls_free_all(junk);
       return NULL;
     }
 
-    glob(ls_data(iter), flags, NULL, ret);
-
-    flags |= GLOB_APPEND;
+    argv_word(ret, ls_data(iter));
   }
 
   ls_free_all(junk);
@@ -406,15 +590,12 @@ pid_t fork_aux(void) {
   return ret;
 }
 
-int exec_aux(char** comm, pid_t pgid, int in_fd, int out_fd, int err_fd) {
-  pid_t pid;
-
-  if (comm == NULL) {
-    error("esh: tried to execute a null command.");
-    exit(EXIT_FAILURE);
-  }
-
-  pid = getpid();
+/*
+ * The setup of a pipeline stage, in the child.
+ */
+static void child_aux(pid_t pgid, int in_fd, int out_fd, int err_fd) {
+  pid_t pid = getpid();
+  sigset_t sigs;
 
   if (!pgid) pgid = pid;
 
@@ -427,11 +608,24 @@ int exec_aux(char** comm, pid_t pgid, int in_fd, int out_fd, int err_fd) {
     signal(SIGTTIN, SIG_DFL);
     signal(SIGTTOU, SIG_DFL);
     signal(SIGCHLD, SIG_DFL);
+
+    /* See "job_watch". */
+    sigemptyset(&sigs);
+    sigprocmask(SIG_SETMASK, &sigs, NULL);
   }
 
   dup2_aux(in_fd, STDIN_FILENO);
   dup2_aux(out_fd, STDOUT_FILENO);
   dup2_aux(err_fd, STDERR_FILENO);
+}
+
+int exec_aux(char** comm, pid_t pgid, int in_fd, int out_fd, int err_fd) {
+  if (comm == NULL) {
+    error("esh: tried to execute a null command.");
+    exit(EXIT_FAILURE);
+  }
+
+  child_aux(pgid, in_fd, out_fd, err_fd);
 
   execvp(comm[0], comm);
 
@@ -439,11 +633,137 @@ int exec_aux(char** comm, pid_t pgid, int in_fd, int out_fd, int err_fd) {
   exit(EXIT_FAILURE);
 }
 
+/*
+ * Start a disk command without forking the shell: "posix_spawn" does
+ * the same setup as "exec_aux" in the child, but without copying the
+ * shell's page tables, so it doesn't slow down as the heap grows. The
+ * command is looked up with "path_find" rather than searched for.
+ * Returns -1 if the command couldn't be started; the caller then falls
+ * back on "fork_aux" and "exec_aux", which report the error the usual
+ * way.
+ */
+static pid_t spawn_aux(char** comm, pid_t pgid,
+		       int in_fd, int out_fd, int err_fd) {
+  posix_spawn_file_actions_t acts;
+  posix_spawnattr_t attr;
+  sigset_t sigs;
+  short flags = POSIX_SPAWN_SETPGROUP;
+  int fds[3];
+  int i;
+  pid_t pid;
+  char* file;
+
+  if (comm == NULL) return -1;
+
+  file = path_find(comm[0]);
+
+  if (!file) return -1;
+
+  fds[0] = in_fd;
+  fds[1] = out_fd;
+  fds[2] = err_fd;
+
+  posix_spawn_file_actions_init(&acts);
+
+  for (i = 0; i < 3; i++) {
+    if (fds[i] != i) {
+      posix_spawn_file_actions_adddup2(&acts, fds[i], i);
+
+      if (fds[i] != STDIN_FILENO &&
+	  fds[i] != STDOUT_FILENO &&
+	  fds[i] != STDERR_FILENO) {
+
+	posix_spawn_file_actions_addclose(&acts, fds[i]);
+      }
+    }
+  }
+
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setpgroup(&attr, pgid);
+
+  if (interactive) {
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGQUIT);
+    sigaddset(&sigs, SIGTSTP);
+    sigaddset(&sigs, SIGTTIN);
+    sigaddset(&sigs, SIGTTOU);
+    sigaddset(&sigs, SIGCHLD);
+
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    flags |= POSIX_SPAWN_SETSIGDEF;
+
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    flags |= POSIX_SPAWN_SETSIGMASK;
+  }
+
+  posix_spawnattr_setflags(&attr, flags);
+
+  if (posix_spawn(&pid, file, &acts, &attr, comm, environ)) {
+    path_forget(comm[0]);
+    pid = -1;
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&acts);
+
+  return pid;
+}
+
+/*
+ * Run a command made with "define" as a pipeline stage. It runs in a
+ * child of the shell, with the standard input and output of the stage
+ * being the pipes, i.e. what "(standard)" returns. The arguments are
+ * the words of the command, after globbing; what the command returns
+ * is thrown away. "next_fd" is the reading end of the stage's output,
+ * which the child must not keep open.
+ */
+static pid_t stage_aux(argv_t* comm, pid_t pgid,
+		       int in_fd, int out_fd, int err_fd, int next_fd) {
+  pid_t pid;
+  list* ls = NULL;
+  int i;
+
+  /* Or the child writes out whatever is still buffered, too. */
+  fflush(NULL);
+
+  pid = fork_aux();
+
+  if (pid) return pid;
+
+  child_aux(pgid, in_fd, out_fd, err_fd);
+
+  /* Nothing is exec'ed here, so close-on-exec doesn't help. */
+  if (next_fd >= 0) {
+    close(next_fd);
+  }
+
+  /* Job control is the shell's business, not the stage's. */
+  interactive = 0;
+
+  for (i = comm->argc - 1; i >= 0; i--) {
+    gc_inc_ref(comm->argv[i]);
+    ls = ls_cons(comm->argv[i], ls);
+  }
+
+  ls_free_all(do_builtin(ls));
+  ls_free_all(ls);
+
+  fflush(NULL);
+  _exit(exception_flag ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
 void pipe_aux(int pipes[2]) {
   if (pipe(pipes)) {
     error("esh: pipe creation failed.");
     exit(EXIT_FAILURE);
   }
+
+  /* Or a stage keeps its own output pipe open, and never sees that
+   * the next stage has quit. */
+  fcntl(pipes[0], F_SETFD, 1);
+  fcntl(pipes[1], F_SETFD, 1);
 }
 
 
@@ -482,29 +802,53 @@ int open_write_aux(char* file) {
 }
 
 
+#define FILE_BLOCK 65536
+#define FILE_WAIT  5000
+
+/*
+ * Read everything up to the end of the file, a block at a time. For a
+ * regular file the size is known up front, so the buffer is usually
+ * allocated only once; anything else starts small and doubles.
+ */
 char* file_read(int fd) {
-  int i = 0;
-  int len = 128;
-  char* buff = (char*)gc_alloc(sizeof(char) * len, "file_read");
-  char foo;
+  struct stat st;
+  size_t len = FILE_BLOCK;
+  size_t i = 0;
+  char* buff;
+  off_t pos;
+  ssize_t n;
+
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    pos = lseek(fd, 0, SEEK_CUR);
+
+    if (pos >= 0 && st.st_size > pos) {
+      len = st.st_size - pos + FILE_BLOCK;
+    }
+  }
+
+  buff = (char*)gc_alloc(sizeof(char) * len, "file_read");
 
   while (1) {
-    if (read(fd, &foo, 1) <= 0) {
-      break;
+    /* Keep a byte for the terminator, and room for a useful read. */
+    if (len - i < FILE_BLOCK / 4) {
+      len *= 2;
+      buff = (char*)gc_realloc(buff, sizeof(char) * len, "file_read");
     }
 
-    if (i >= len-2) {
-      char* tmp = (char*)gc_alloc(sizeof(char) * len * 2, "file_read");
+    n = read(fd, buff + i, len - i - 1);
 
-      len *= 2;
+    if (n < 0 && errno == EINTR && !exception_flag) continue;
 
-      strcpy(tmp, buff);
-      gc_free(buff);
-      buff = tmp;
+    if (n <= 0) {
+      break;
     }
 
-    buff[i] = foo;
-    i++;
+    i += n;
+  }
+
+  /* Don't keep a doubled buffer around for the lifetime of the string. */
+  if (len - i > FILE_BLOCK / 4) {
+    buff = (char*)gc_realloc(buff, sizeof(char) * (i + 1), "file_read");
   }
 
   buff[i] = '\0';
@@ -512,20 +856,42 @@ char* file_read(int fd) {
   return buff;
 }
 
-void file_write(int fd, char* data) {
-  int i = 0;
+/*
+ * Write the whole string, however many calls it takes. A descriptor
+ * in non-blocking mode is waited for, but only for so long without
+ * any progress. Returns the number of bytes written.
+ */
+long file_write(int fd, char* data) {
+  struct pollfd pfd;
+  size_t len = strlen(data);
+  size_t i = 0;
+  ssize_t n;
+
+  while (i < len) {
+    n = write(fd, data + i, len - i);
+
+    if (n > 0) {
+      i += n;
+      continue;
+    }
 
-  while (1) {
-    if (!data[i]) break;
+    if (n < 0 && errno == EINTR && !exception_flag) continue;
 
-    if (write(fd, &data[i], 1) <= 0) {
-      break;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+
+      if (poll(&pfd, 1, FILE_WAIT) > 0 && !exception_flag) continue;
     }
 
-    i++;
+    break;
   }
+
+  return i;
 }
 
+
 void show_status(job_t* job, int stat) {
 
   if (WIFEXITED(stat)) {
@@ -630,46 +996,73 @@ void show_status(job_t* job, int stat) {
 
 
 /*
- * The argument is a dummy value so that this function can be used
- * as a signal handler.
+ * For the trace: the exit status, or minus the signal number.
  */
+static int wait_value(int stat) {
+  if (WIFEXITED(stat)) {
+    return WEXITSTATUS(stat);
 
-void babysit(int signum) {
-  list* iter;
-  job_t* job;
-  int stat;
-  int tmp;
+  } else if (WIFSIGNALED(stat)) {
+    return -WTERMSIG(stat);
 
-  for (iter = jobs; iter != NULL; iter = ls_next(iter)) {
-    job = ls_data(iter);
+  } else {
+    return -WSTOPSIG(stat);
+  }
+}
 
-    while (1) {
-      tmp = waitpid(-job->pgid, &stat, WUNTRACED | WNOHANG);
 
-      if (tmp <= 0) break;
+/*
+ * Outside of job control, pipelines stay in the shell's own process
+ * group, so only the last process can be signalled.
+ */
+static void job_signal(job_t* job, int sig) {
+  if (job->pgid != getpgrp()) {
+    kill(-job->pgid, sig);
+
+  } else {
+    kill(job->last_pid, sig);
+  }
+}
 
-      if (tmp == job->last_pid) {
-	show_status(job, stat);
-      }
+/*
+ * Wait no longer than "with-budget" allows; past the deadline the job
+ * is terminated, and killed if it won't go.
+ */
+static void job_deadline(job_t* job) {
+  long left = budget_left();
 
-      if (job->status == JOB_DEAD) {
-	kill(-job->pgid, SIGPIPE);
-	job->status = JOB_DEAD;
-      }
-    }
+  if (left < 0 || job_linger(job->last_pid, left) || exception_flag) {
+    return;
   }
 
-  signal(SIGCHLD, babysit);
+  budget_expire();
+
+  job_signal(job, SIGTERM);
+
+  if (!job_linger(job->last_pid, BUDGET_GRACE)) {
+    job_signal(job, SIGKILL);
+  }
 }
 
 
 void job_wait(job_t* job) {
+  struct rusage ru;
   int tmp;
-  sig_t oldsig;
+  int stat;
+
+  if (tracing) {
+    trace_record(TRACE_WAIT, job->name, job->last_pid);
+  }
+
+  if (budgeting) {
+    job_deadline(job);
+  }
 
-  oldsig = signal(SIGCHLD, SIG_DFL);
   if (interactive) {
-    waitpid(job->last_pid, &tmp, WUNTRACED);
+    if (wait4(job->last_pid, &tmp, WUNTRACED, &ru) > 0) {
+      job_account(job, &ru);
+      job_exited(job->last_pid, tmp);
+    }
 
     if (job->name) {
       show_status(job, tmp);
@@ -678,15 +1071,21 @@ void job_wait(job_t* job) {
     if (job->status == JOB_DEAD) {
       kill(-job->pgid, SIGPIPE);
 
-      while (waitpid(-job->pgid, &tmp, WUNTRACED) > 0) {
-	/* Nothing. */
+      while (wait4(-job->pgid, &stat, WUNTRACED, &ru) > 0) {
+	job_account(job, &ru);
       }
     }
 
   } else {
-    waitpid(job->last_pid, &tmp, WUNTRACED);
+    if (wait4(job->last_pid, &tmp, WUNTRACED, &ru) > 0) {
+      job_account(job, &ru);
+      job_exited(job->last_pid, tmp);
+    }
+  }
+
+  if (tracing) {
+    trace_record(TRACE_DONE, job->name, wait_value(tmp));
   }
-  signal(SIGCHLD, oldsig);
 }
 
 
@@ -741,45 +1140,11 @@ void job_background(job_t* job) {
 
 
 void arrange_funeral(void) {
-  list* jnew = NULL;
-  list* iter;
-  job_t* job;
+  job_reap();
 
-  int foo = 0;
-
-  if (!interactive) {
-    while (waitpid(0, NULL, WUNTRACED | WNOHANG) > 0) {
-      /* Nothing. */
-    }
-
-    return;
-  }
-
-  if (!jobs) return;
-
-  for (iter = jobs; iter != NULL; iter = ls_next(iter)) {
-    job = ls_data(iter);
-
-    if (job->status == JOB_DEAD) foo = 1;
-  }
-
-  if (!foo) return;
-
-  for (iter = jobs; iter != NULL; iter = ls_next(iter)) {
-    job = ls_data(iter);
-
-    if (job->status == JOB_DEAD) {
-      gc_free(job->name);
-      gc_free(job);
-
-    } else {
-      jnew = ls_cons(job, jnew);
-    }
+  if (interactive) {
+    job_bury();
   }
-
-  ls_free(jobs);
-
-  jobs = ls_reverse(jnew);
 }
 
 
@@ -790,7 +1155,7 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
   int input_src = STDIN_FILENO;
   int output_sink;
 
-  glob_t* comm = NULL;
+  argv_t* comm = NULL;
 
   job_t* job = NULL;
 
@@ -798,9 +1163,15 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
 
   job = (job_t*)gc_alloc(sizeof(job_t), "do_pipe");
   job->name = NULL;
+  job->procs = 0;
+  memset(&job->usage, 0, sizeof(job->usage));
 
   if (!interactive) {
-    pgid = getpid();
+    pgid = getpgrp();
+
+  } else if (bg) {
+    /* Or a loop that starts jobs piles up zombies until the prompt. */
+    job_reap();
   }
 
   input_src = f_src;
@@ -823,12 +1194,37 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
 
     }
 
+    /*
+     * A lone command in the foreground might not need a process at
+     * all; see native.h. Aliases and defines still get to override.
+     */
+    if (!bg && !i && !ls_next(ls) &&
+	!hash_get(aliases, comm->argv[0]) &&
+	!hash_get(defines, comm->argv[0])) {
+
+      ret = native_run(comm->argv, input_src, f_out, stderr_handler_fd);
+
+      if (ret != NATIVE_DECLINE) {
+	if (destructive) {
+	  close_aux(f_out);
+	}
+
+	argv_free(comm);
+	gc_free(comm);
+	gc_free(job);
+
+	return ret;
+      }
+
+      ret = 0;
+    }
+
     if (!job->name) {
       job->name = (char*)gc_alloc(sizeof(char) *
-				(strlen(comm->gl_pathv[0])+1),
+				(strlen(comm->argv[0])+1),
 				  "do_pipe");
 
-      strcpy(job->name, comm->gl_pathv[0]);
+      strcpy(job->name, comm->argv[0]);
     }
 
     if (ls_next(ls)) {
@@ -840,11 +1236,22 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
     }
 
 
-    pid = fork_aux();
+    if (hash_get(defines, comm->argv[0])) {
+      pid = stage_aux(comm, pgid, input_src, output_sink,
+		      stderr_handler_fd, (ls_next(ls) ? pipes[0] : -1));
+
+    } else {
+      pid = spawn_aux(comm->argv, pgid, input_src, output_sink,
+		      stderr_handler_fd);
+
+      if (pid < 0) {
+	pid = fork_aux();
+      }
+    }
 
     if (pid == 0) {
 
-      exec_aux(comm->gl_pathv, pgid, input_src, output_sink,
+      exec_aux(comm->argv, pgid, input_src, output_sink,
 	       stderr_handler_fd);
 
     } else {
@@ -852,10 +1259,17 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
 
       last_pid = pid;
 
+      job->procs++;
+      job_procs++;
+
+      if (tracing) {
+	trace_record(TRACE_FORK, comm->argv[0], pid);
+      }
+
       setpgid(pid, pgid);
     }
 
-    globfree(comm);
+    argv_free(comm);
     gc_free(comm);
     comm = NULL;
 
@@ -877,7 +1291,7 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
   job->value = 0;
 
   if (interactive) {
-    jobs = ls_cons(job, jobs);
+    job_add(job);
   }
 
   if (!bg) {
@@ -912,7 +1326,7 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
   }
 
   if (comm) {
-    globfree(comm);
+    argv_free(comm);
     gc_free(comm);
   }
 
@@ -920,10 +1334,68 @@ pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destructive) {
 }
 
 
-list* do_builtin(list* ls) {
+/*
+ * "kind" is set to the ownership of the returned list; see builtins.h.
+ */
+static list* run_define(list* body, list* args) {
+  list* ret;
+  list* oldstack = ls_move(&stack);
+
+  stack = ls_copy(args);
+
+  trace_depth++;
+  ret = eval(body);
+  trace_depth--;
+
+  ls_free_all(stack);
+  stack = oldstack;
+
+  return ret;
+}
+
+
+/*
+ * A command created with "define-memo" only runs if the same arguments
+ * haven't been seen before. Arguments that can't be made into a key
+ * bypass the cache, and so do calls that end in an exception.
+ */
+static list* run_memo(char* name, memo* m, list* body, list* args) {
+  char* key = memo_key(args);
+  list* ret;
+
+  if (!key) {
+    return run_define(body, args);
+  }
+
+  if (memo_get(m, key, &ret)) {
+    gc_free(key);
+    return ls_copy(ret);
+  }
+
+  /* The body might define the command again, memo and all. */
+  gc_inc_ref(m);
+
+  ret = run_define(body, args);
+
+  if (exception_flag || hash_get(memos, name) != m) {
+    gc_free(key);
+
+  } else {
+    memo_put(m, key, ls_copy(ret));
+  }
+
+  memo_free(m);
+
+  return ret;
+}
+
+
+static list* run_builtin(list* ls, int* kind) {
   list* (*func)(list*);
   list* foo;
 
+  (*kind) = RESULT_OWNED;
+
   if (ls == NULL || exception_flag) return NULL;
 
   if (ls_type(ls) != TYPE_STRING) {
@@ -940,28 +1412,86 @@ list* do_builtin(list* ls) {
   }
 
   if (foo) {
+    memo* m = hash_get(memos, ls_data(ls));
     list* ret;
-    list* oldstack = stack;
 
-    stack = ls_copy(ls_next(ls));
-    ret = eval(foo);
+    /* The body can define the command again while it runs. */
+    foo = ls_copy(foo);
+
+    if (m) {
+      ret = run_memo(ls_data(ls), m, foo, ls_next(ls));
 
-    ls_free_all(stack);
-    stack = oldstack;
+    } else {
+      ret = run_define(foo, ls_next(ls));
+    }
+
+    ls_free_all(foo);
 
     return ret;
 
   } else {
-    return func(ls_next(ls));
+    list* ret;
+
+    result_kind = RESULT_OWNED;
+    ret = func(ls_next(ls));
+
+    (*kind) = result_kind;
+    result_kind = RESULT_OWNED;
+
+    return ret;
+  }
+}
+
+
+list* do_builtin_kind(list* ls, int* kind) {
+  list* ret;
+  char* name;
+
+  if (!(profiling | tracing | budgeting)) {
+    return run_builtin(ls, kind);
+  }
+
+  if (budgeting && budget_step()) {
+    (*kind) = RESULT_OWNED;
+    exception_flag = 1;
+
+    return NULL;
+  }
+
+  name = ((ls && ls_type(ls) == TYPE_STRING) ? ls_data(ls) : "?");
+
+  if (tracing) {
+    trace_record(TRACE_CALL, name, 0);
+  }
+
+  if (!profiling) {
+    return run_builtin(ls, kind);
   }
+
+  profile_enter(name);
+  ret = run_builtin(ls, kind);
+  profile_leave();
+
+  return ret;
+}
+
+
+list* do_builtin(list* ls) {
+  int kind;
+  list* ret = do_builtin_kind(ls, &kind);
+
+  if (kind == RESULT_BORROWED) {
+    ls_claim(ret);
+  }
+
+  return ret;
 }
 
 list* parse_builtin(char* input, int* i, int liter, int delay) {
   list* ls = NULL;
 
   char token;
-  int len = 128;
-  char* value = (char*)gc_alloc(sizeof(char)*len, "parse_builtin");
+  token_t tok;
 
   int did_pass = 0;
   int pass_liter = 0;
@@ -969,7 +1499,7 @@ list* parse_builtin(char* input, int* i, int liter, int delay) {
   list* passthru = NULL;
   list* ret = NULL;
 
-  token = next_token(input, i, &value, &len);
+  token = next_token(input, i, &tok);
 
   if (!openparen(token)) {
     error("esh: parse error: commands should always use "
@@ -981,7 +1511,7 @@ list* parse_builtin(char* input, int* i, int liter, int delay) {
     did_pass = 0;
     pass_liter = 0;
     pass_delay = 0;
-    token = next_token(input, i, &value, &len);
+    token = next_token(input, i, &tok);
 
     if (!token) {
       error("esh: parse error: no closing parentheses.");
@@ -1049,13 +1579,10 @@ list* parse_builtin(char* input, int* i, int liter, int delay) {
 	}
       }
     } else {
-      ls = ls_cons(value, ls);
-      value = (char*)gc_alloc(sizeof(char) * len, "parse_builtin");
+      ls = ls_cons(token_strcpy(input, &tok), ls);
     }
   }
 
-  gc_free(value);
-
   ls = ls_reverse(ls);
 
   if (liter) {
@@ -1070,32 +1597,25 @@ list* parse_builtin(char* input, int* i, int liter, int delay) {
 
  done:
   ls_free_all(ls);
-  gc_free(value);
   return NULL;
 
 }
 
 
-list* parse_sequence(list* ret, char* input, int* i, char* tok) {
-  int len = 127;
-  char* value = (char*)gc_alloc(sizeof(char) * len,
-				"parse_sequence");
+list* parse_sequence(list* ret, char* input, int* i, char* token) {
+  token_t tok;
+
   while (1) {
-    (*tok) = next_token(input, i, &value, &len);
+    (*token) = next_token(input, i, &tok);
 
-    if (special(*tok)) {
+    if (special(*token)) {
       break;
 
     } else {
-      ret = ls_cons(value, ret);
-
-      value = (char*)gc_alloc(sizeof(char) * len,
-			      "parse_sequence");
+      ret = ls_cons(token_strcpy(input, &tok), ret);
     }
   }
 
-  gc_free(value);
-
   return ret;
 }
 
@@ -1142,8 +1662,7 @@ void parse_pipe(char* input) {
 
   char token, old, foo = -1;
   int i = 0, bar = 0;
-  int len = 128;
-  char* value = (char*)gc_alloc(sizeof(char) * len, "parse_pipe");
+  token_t tok;
 
   list* catter;
 
@@ -1162,24 +1681,22 @@ void parse_pipe(char* input) {
 
   for (bar = 0; bar < 2; bar++) {
     if (old) {
-      token = next_token(input, &i, &value, &len);
+      token = next_token(input, &i, &tok);
 
       if (redirect_in(old) && !special(token) && !f_in) {
-	f_in = value;
+	f_in = token_strcpy(input, &tok);
 	foo = -1;
-	value = (char*)gc_alloc(sizeof(char) * len, "parse_pipe");
 
       } else if (redirect_out(old) && !special(token) && !f_out) {
-	f_out = value;
+	f_out = token_strcpy(input, &tok);
 	foo = -1;
-	value = (char*)gc_alloc(sizeof(char) * len, "parse_pipe");
 
       } else {
 	error("esh: parse error: special syntax where redirection should be.");
 	goto done;
       }
 
-      old = next_token(input, &i, &value, &len);
+      old = next_token(input, &i, &tok);
     }
   }
 
@@ -1229,7 +1746,6 @@ void parse_pipe(char* input) {
  done:
 
   ls_free_all(ls);
-  gc_free(value);
 
   if (f_in)  gc_free(f_in);
   if (f_out) gc_free(f_out);
@@ -1275,6 +1791,14 @@ static void ls_print_aux(list* ls, int i, int delay) {
     case TYPE_PROC:
       printf("<process: %d>", *(pid_t*)(ls_data(iter)));
       break;
+
+    case TYPE_STREAM:
+      printf("<stream: %d>", ((stream_t*)ls_data(iter))->fd);
+      break;
+
+    case TYPE_COPROC:
+      printf("<coprocess: %d>", ((coproc_t*)ls_data(iter))->last_pid);
+      break;
     }
 
     if (ls_next(iter)) {
@@ -1295,12 +1819,11 @@ void ls_print(list* ls) {
 void parse_command(char* input) {
   int i = 0;
   char token;
-  int len = 128;
-  char* value = (char*)gc_alloc(sizeof(char) * len, "parse_command");
+  token_t tok;
 
   syntax_fancy = 1;
 
-  token = next_token(input, &i, &value, &len);
+  token = next_token(input, &i, &tok);
 
   if (openparen(token)) {
     list* ret;
@@ -1310,12 +1833,11 @@ void parse_command(char* input) {
     i = 0;
     ret = parse_builtin(input, &i, 0, 0);
 
-    token = next_token(input, &i, &value, &len);
+    token = next_token(input, &i, &tok);
 
     if (token) {
       error("esh: extraneous characters after command.");
 
-      gc_free(value);
       ls_free_all(ret);
       return;
     }
@@ -1340,8 +1862,106 @@ void parse_command(char* input) {
   } else {
     parse_pipe(input);
   }
+}
+
+
+/*
+ * Scripts are read a block at a time when the file is seekable. Since
+ * subprocesses may share the script file (the script could be coming in
+ * through the standard input), whatever was read past the end of the
+ * current command is given back with "lseek" before the command is run.
+ * Unseekable files have to be read a character at a time.
+ */
+
+#define SCRIPT_BLOCK 4096
 
-  gc_free(value);
+typedef struct script_input script_input;
+
+struct script_input {
+  int fd;
+  int block;
+  int pos;
+  int have;
+  char data[SCRIPT_BLOCK];
+};
+
+
+static void script_open(script_input* in, int fd) {
+  in->fd = fd;
+  in->block = (lseek(fd, 0, SEEK_CUR) >= 0);
+  in->pos = 0;
+  in->have = 0;
+}
+
+static int script_fill(script_input* in) {
+  int n;
+
+  if (in->pos < in->have) return 1;
+
+  n = read(in->fd, in->data, (in->block ? SCRIPT_BLOCK : 1));
+
+  if (n <= 0) return 0;
+
+  in->pos = 0;
+  in->have = n;
+
+  return 1;
+}
+
+static void script_close(script_input* in) {
+  if (in->block && in->pos < in->have) {
+    lseek(in->fd, in->pos - in->have, SEEK_CUR);
+  }
+
+  in->pos = 0;
+  in->have = 0;
+}
+
+static void script_append(char** buff, int* len, int* i, char* data, int n) {
+  if ((*i) + n >= (*len)-1) {
+    char* tmp;
+
+    while ((*i) + n >= (*len)-1) {
+      (*len) *= 2;
+    }
+
+    tmp = (char*)gc_alloc(sizeof(char) * (*len), "parse_file");
+
+    memcpy(tmp, (*buff), (*i));
+    gc_free((*buff));
+    (*buff) = tmp;
+  }
+
+  memcpy((*buff) + (*i), data, n);
+  (*i) += n;
+}
+
+/*
+ * Skip over the input up to (but not including) the given character,
+ * appending what was skipped to the buffer if "buff" is not NULL.
+ * Returns 0 on end of file.
+ */
+
+static int script_skip(script_input* in, char stop,
+		       char** buff, int* len, int* i) {
+  char* found;
+  int n;
+
+  while (script_fill(in)) {
+    found = memchr(in->data + in->pos, stop, in->have - in->pos);
+
+    n = (found ? found - (in->data + in->pos) : in->have - in->pos);
+
+    if (buff) {
+      script_append(buff, len, i, in->data + in->pos, n);
+    }
+
+    in->pos += n;
+
+    if (found) return 1;
+  }
+
+  return 0;
 }
 
 
@@ -1355,11 +1975,15 @@ int parse_file(int file, char** buff, int* len) {
   int junk = 0;
   list* ret;
 
+  script_input in;
+
   syntax_fancy = 0;
 
+  script_open(&in, file);
+
   while (1) {
 
-    if (read(file, &chr, 1) <= 0) {
+    if (!script_fill(&in)) {
 
       if (parencount || inquote) {
         error("esh: premature end of file while reading a script.");
@@ -1368,14 +1992,15 @@ int parse_file(int file, char** buff, int* len) {
       return 0;
     }
 
+    chr = in.data[in.pos++];
+
     if (!inquote && comment(chr)) {
-      while (1) {
+      script_skip(&in, '\n', NULL, NULL, NULL);
 
-	if (read(file, &chr, 1) <= 0) {
-	  break;
-	}
+      chr = '\n';
 
-	if (chr == '\n') break;
+      if (script_fill(&in)) {
+	in.pos++;
       }
     }
 
@@ -1385,6 +2010,10 @@ int parse_file(int file, char** buff, int* len) {
 
       } else if (!inquote) {
 	inquote = quote(chr);
+
+	script_append(buff, len, &i, &chr, 1);
+	script_skip(&in, chr, buff, len, &i);
+	continue;
       }
 
     } else if (!inquote && openparen(chr)) {
@@ -1396,23 +2025,13 @@ int parse_file(int file, char** buff, int* len) {
 
     }
 
-    if (i >= (*len)-2) {
-      char* tmp = (char*)gc_alloc(sizeof(char) * (*len) * 2, "parse_file");
-
-      (*len) *= 2;
-
-      strcpy(tmp, (*buff));
-      gc_free((*buff));
-      (*buff) = tmp;
-    }
-
-    (*buff)[i] = chr;
-
-    i++;
+    script_append(buff, len, &i, &chr, 1);
 
     if (!parencount && did_one) break;
   }
 
+  script_close(&in);
+
   (*buff)[i] = '\0';
 
   ret = parse_builtin((*buff), &junk, 0, 0);
@@ -1498,12 +2117,16 @@ void init_shell(int argc, char** argv) {
   tmp2 = (int*)gc_alloc(sizeof(int) * 2, "init_shell");
 
   builtins = (hash_table*)gc_alloc(sizeof(hash_table), "init_shell");
+  borrowers = (hash_table*)gc_alloc(sizeof(hash_table), "init_shell");
   aliases = (hash_table*)gc_alloc(sizeof(hash_table), "init_shell");
   defines = (hash_table*)gc_alloc(sizeof(hash_table), "init_shell");
+  memos = (hash_table*)gc_alloc(sizeof(hash_table), "init_shell");
 
   hash_init(builtins, builtins_array);
+  hash_init(borrowers, borrowers_array);
   hash_init(aliases, NULL);
   hash_init(defines, NULL);
+  hash_init(memos, NULL);
 
   interactive = isatty(shell_terminal_fd);
 
@@ -1545,7 +2168,7 @@ void init_shell(int argc, char** argv) {
     signal(SIGTTIN, SIG_IGN);
     signal(SIGTTOU, SIG_IGN);
 
-    signal(SIGCHLD, babysit);
+    job_watch();
 
     self_pid = getpid();
 
@@ -1618,13 +2241,7 @@ int main(int argc, char** argv, char** env) {
 
 #ifdef MEM_DEBUG
 
-  for (tmp = jobs; tmp != NULL; tmp = ls_next(tmp)) {
-    gc_free(((job_t*)ls_data(tmp))->name);
-  }
-
-  ls_free_all(jobs);
-
-  jobs = NULL;
+  job_done();
 
   ls_free_all(ls_void);
   ls_free_all(ls_true);
@@ -1634,13 +2251,26 @@ int main(int argc, char** argv, char** env) {
   ls_free_all(prompt);
   ls_free_all(stack);
 
+  if (alias_argvs) {
+    hash_free(alias_argvs, alias_argv_free);
+    gc_free(alias_argvs);
+  }
+
   hash_free(aliases, ls_free_all);
   hash_free(defines, ls_free_all);
+  hash_free(memos, memo_free);
   hash_free(builtins, NULL);
+  hash_free(borrowers, NULL);
 
   gc_free(aliases);
   gc_free(defines);
+  gc_free(memos);
+
+  profile_done();
+  plugin_done();
+  path_done();
   gc_free(builtins);
+  gc_free(borrowers);
 
   if (syntax_blank) {
     gc_free(syntax_blank);
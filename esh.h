@@ -13,8 +13,9 @@ extern int stderr_handler_fd;
 
 extern hash_table* aliases;
 extern hash_table* defines;
+extern hash_table* memos;
 extern hash_table* builtins;
-extern list* jobs;
+extern hash_table* borrowers;
 extern list* prompt;
 extern list* stack;
 extern list* ls_true;
@@ -27,21 +28,24 @@ extern char** environ;
 extern char* syntax_blank;
 
 extern char* dynamic_strcpy(char* chr);
+extern char* token_strcpy(char* input, token_t* tok);
 
 extern char* file_read(int fd);
-extern void file_write(int fd, char* data);
+extern long file_write(int fd, char* data);
 
-extern char next_token(char* input, int* i, char** value, int* len);
+extern char next_token(char* input, int* i, token_t* tok);
 extern list* parse_builtin(char* input, int* len, int liter, int delay);
 extern list* parse_split(char* input);
 
 extern pid_t do_pipe(int f_src, int f_out, list* ls, int bg, int destruc);
 extern list* do_builtin(list* ls);
+extern list* do_builtin_kind(list* ls, int* kind);
 extern void do_file(char* file, int do_error);
 
 extern void ls_print(list* ls);
 extern char* ls_strcat(list* ls);
 
+extern void show_status(job_t* job, int stat);
 extern void job_foreground(job_t* job);
 extern void job_background(job_t* job);
 
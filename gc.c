@@ -16,25 +16,76 @@
  * program call gc_free whenever an object should be deleted. As such,
  * this cannot really be called garbage collection, though it does serve
  * a purpose as a central repository of all allocated memory.
+ *
+ * Every chunk starts with a header of two size_t's, so that what is
+ * handed out stays as aligned as "malloc" made it: the size of the
+ * chunk comes first, and the reference count is the int right before
+ * the pointer handed out.
  */
 
+#define GC_HEADER (2 * sizeof(size_t))
+
+#define GC_SIZE(ptr) (*(size_t*)((ptr) - GC_HEADER))
+
 
 int __gc_alloc = 0;
+int __gc_allocs = 0;
+long __gc_bytes = 0;
+
+#ifdef MEM_DEBUG
+int __gc_refops = 0;
+#endif
 
 
 void* gc_alloc(size_t size, char* where) {
-  void* ret = malloc(size + sizeof(int));
+  void* ret = malloc(size + GC_HEADER);
 
   if (!ret) {
     error("esh: could not allocate memory.");
     exit(EXIT_FAILURE);
   }
 
-  ((int*)ret)[0] = 1;
+  ret += GC_HEADER;
+
+  GC_SIZE(ret) = size;
+  ((int*)ret)[-1] = 1;
 
   __gc_alloc++;
+  __gc_allocs++;
+  __gc_bytes += size;
 
-  return ret + sizeof(int);
+  return ret;
+}
+
+
+/*
+ * Resize a chunk that nobody else has a reference to. The contents are
+ * kept, up to the smaller of the two sizes.
+ */
+void* gc_realloc(void* ptr, size_t size, char* where) {
+  int* ref = (int*)(ptr - sizeof(int));
+  void* ret;
+
+  if ((*ref) != 1) {
+    error("esh: tried to resize a shared chunk in %s.", where);
+    exit(EXIT_FAILURE);
+  }
+
+  __gc_bytes -= GC_SIZE(ptr);
+
+  ret = realloc(ptr - GC_HEADER, size + GC_HEADER);
+
+  if (!ret) {
+    error("esh: could not allocate memory.");
+    exit(EXIT_FAILURE);
+  }
+
+  ret += GC_HEADER;
+
+  GC_SIZE(ret) = size;
+  __gc_bytes += size;
+
+  return ret;
 }
 
 
@@ -48,6 +99,10 @@ inline void gc_inc_ref(void* ptr) {
 
   (*ref)++;
   __gc_alloc++;
+
+#ifdef MEM_DEBUG
+  __gc_refops++;
+#endif
 }
 
 void gc_add_ref(void* ptr, int add) {
@@ -61,6 +116,10 @@ void gc_add_ref(void* ptr, int add) {
   (*ref) += add;
   __gc_alloc += add;
 
+#ifdef MEM_DEBUG
+  __gc_refops++;
+#endif
+
   if ((*ref) <= 0) {
     error("esh: tried to set an invalid ref count.");
     exit(EXIT_FAILURE);
@@ -91,13 +150,39 @@ inline void gc_free(void* ptr) {
   (*ref)--;
   __gc_alloc--;
 
+#ifdef MEM_DEBUG
+  __gc_refops++;
+#endif
+
   if (!(*ref)) {
-    free(ptr - sizeof(int));
+    __gc_bytes -= GC_SIZE(ptr);
+    free(ptr - GC_HEADER);
   }
 }
 
 
+/*
+ * The number of calls to "gc_alloc" so far; only differences between
+ * two calls mean anything.
+ */
+int gc_allocations(void) {
+  return __gc_allocs;
+}
+
+
+/*
+ * The number of bytes in chunks that haven't been freed.
+ */
+long gc_bytes(void) {
+  return __gc_bytes;
+}
+
+
 void gc_diagnostics(void) {
   printf("\nAllocated chunks: %d\n", __gc_alloc);
+
+#ifdef MEM_DEBUG
+  printf("Reference count updates: %d\n", __gc_refops);
+#endif
 }
 
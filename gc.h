@@ -17,10 +17,13 @@ struct gc_node {
 
 
 extern void* gc_alloc(size_t size, char* where);
+extern void* gc_realloc(void* ptr, size_t size, char* where);
 extern void gc_inc_ref(void* ptr);
 extern void gc_add_ref(void* ptr, int add);
 extern int gc_refs(void* ptr);
 extern void gc_free(void* ptr);
+extern int gc_allocations(void);
+extern long gc_bytes(void);
 extern void gc_diagnostics(void);
 
 #endif /* !__gc_h__ */
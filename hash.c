@@ -114,6 +114,41 @@ void* hash_get(hash_table* _hash_array, char* key) {
   return NULL;
 }
 
+void* hash_del(hash_table* _hash_array, char* key) {
+  int idx = hash(key);
+
+  list* prev = NULL;
+  list* iter;
+  hash_entry* hs_ent;
+  void* ret;
+
+  for (iter = (*_hash_array)[idx]; iter != NULL; iter = ls_next(iter)) {
+    hs_ent = (hash_entry*)ls_data(iter);
+
+    if (strcmp(hs_ent->key, key) == 0) {
+      if (prev) {
+	ls_next_set(prev, ls_next(iter));
+
+      } else {
+	(*_hash_array)[idx] = ls_next(iter);
+      }
+
+      ret = hs_ent->data;
+
+      gc_free(hs_ent->key);
+      gc_free(hs_ent);
+      gc_free(iter);
+
+      return ret;
+    }
+
+    prev = iter;
+  }
+
+  return NULL;
+}
+
+
 /*
  * Uglification alert.
  */
@@ -12,7 +12,9 @@
  *
  * Pitfalls:
  *
- *  + You cannot delete elements from the cache.
+ *  + "hash_del" removes an element and returns its data; the key is
+ *    freed, the data is yours. Never call it on a table that has been
+ *    shared with "hash_inc_ref".
  *  + Calling "hash_put" or "hash_get" before "hash_init" likely
  *    means a segfault.
  *  + "hash_init" should always be called. Pass a NULL as the second
@@ -43,6 +45,7 @@ extern void* hash_put(hash_table* t, char* key, void* data);
 extern void* hash_put_inc_ref(hash_table* t, char* key, void* data);
 extern void hash_init(hash_table* t, hash_entry data[]);
 extern void* hash_get(hash_table* t, char* key);
+extern void* hash_del(hash_table* t, char* key);
 
 extern void hash_free(hash_table* t,
 		      void (*func)());
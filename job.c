@@ -0,0 +1,629 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
+
+#include "format.h"
+#include "list.h"
+#include "gc.h"
+#include "hash.h"
+#include "job.h"
+#include "token.h"
+#include "esh.h"
+
+#define JOB_SLOTS      16
+
+#define INDEX_EMPTY    0
+#define INDEX_GONE     (-1)
+
+
+/*
+ * A map from PIDs to numbers, open addressed. It is used for the index
+ * of the job table, and for the exit statuses of background processes.
+ */
+typedef struct pid_entry pid_entry;
+typedef struct pid_map pid_map;
+
+struct pid_entry {
+  pid_t pid;
+  int val;
+};
+
+struct pid_map {
+  pid_entry* ents;
+  int size;
+  int fill;
+  int live;
+};
+
+
+static job_t** table = NULL;
+static int slots = 0;
+static int used = 0;
+static int hint = 0;
+static int latest = -1;
+
+static pid_map pids = { NULL, 0, 0, 0 };
+static pid_map exits = { NULL, 0, 0, 0 };
+
+static int sig_fd = -1;
+
+struct rusage job_usage;
+long job_procs = 0;
+
+
+static int map_hash(pid_map* m, pid_t pid) {
+  return (int)(((unsigned int)pid * 2654435761U) & (m->size - 1));
+}
+
+
+static void map_put(pid_map* m, pid_t pid, int val);
+
+
+static void map_grow(pid_map* m) {
+  pid_entry* old = m->ents;
+  int old_size = m->size;
+  int i;
+
+  m->size = JOB_SLOTS * 4;
+
+  while (m->size < m->live * 4) {
+    m->size *= 2;
+  }
+
+  m->ents = (pid_entry*)gc_alloc(sizeof(pid_entry) * m->size, "map_grow");
+
+  for (i = 0; i < m->size; i++) {
+    m->ents[i].pid = INDEX_EMPTY;
+  }
+
+  m->fill = 0;
+  m->live = 0;
+
+  for (i = 0; i < old_size; i++) {
+    if (old[i].pid != INDEX_EMPTY && old[i].pid != INDEX_GONE) {
+      map_put(m, old[i].pid, old[i].val);
+    }
+  }
+
+  if (old) {
+    gc_free(old);
+  }
+}
+
+
+static void map_put(pid_map* m, pid_t pid, int val) {
+  int i;
+  int gone = -1;
+
+  if ((m->fill + 1) * 2 > m->size) {
+    map_grow(m);
+  }
+
+  for (i = map_hash(m, pid); m->ents[i].pid != INDEX_EMPTY;
+       i = (i + 1) & (m->size - 1)) {
+
+    if (m->ents[i].pid == pid) {
+      m->ents[i].val = val;
+      return;
+    }
+
+    if (m->ents[i].pid == INDEX_GONE && gone < 0) {
+      gone = i;
+    }
+  }
+
+  if (gone < 0) {
+    gone = i;
+    m->fill++;
+  }
+
+  m->ents[gone].pid = pid;
+  m->ents[gone].val = val;
+  m->live++;
+}
+
+
+/*
+ * Returns the entry, or NULL.
+ */
+static pid_entry* map_find(pid_map* m, pid_t pid) {
+  int i;
+
+  if (!m->ents || pid <= 0) return NULL;
+
+  for (i = map_hash(m, pid); m->ents[i].pid != INDEX_EMPTY;
+       i = (i + 1) & (m->size - 1)) {
+
+    if (m->ents[i].pid == pid) return &m->ents[i];
+  }
+
+  return NULL;
+}
+
+
+static void map_del(pid_map* m, pid_entry* ent) {
+  ent->pid = INDEX_GONE;
+  m->live--;
+}
+
+
+static void map_free(pid_map* m) {
+  if (m->ents) {
+    gc_free(m->ents);
+  }
+
+  m->ents = NULL;
+  m->size = m->fill = m->live = 0;
+}
+
+
+void job_watch(void) {
+  sigset_t sigs;
+
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGCHLD);
+
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+
+#ifdef __linux__
+  sig_fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+#endif
+}
+
+
+int job_add(job_t* job) {
+  int id;
+
+  for (id = hint; id < slots && table[id]; id++) {
+    /* Nothing. */
+  }
+
+  if (id == slots) {
+    job_t** tmp;
+    int i;
+
+    slots = (slots ? slots * 2 : JOB_SLOTS);
+
+    tmp = (job_t**)gc_alloc(sizeof(job_t*) * slots, "job_add");
+
+    for (i = 0; i < slots; i++) {
+      tmp[i] = (i < id ? table[i] : NULL);
+    }
+
+    if (table) {
+      gc_free(table);
+    }
+
+    table = tmp;
+  }
+
+  table[id] = job;
+  job->id = id;
+
+  hint = id + 1;
+  latest = id;
+
+  if (id >= used) {
+    used = id + 1;
+  }
+
+  map_put(&pids, job->last_pid, id);
+
+  return id;
+}
+
+
+job_t* job_get(int id) {
+  if (id < 0 || id >= used) return NULL;
+
+  return table[id];
+}
+
+
+job_t* job_by_pid(pid_t pid) {
+  pid_entry* ent = map_find(&pids, pid);
+
+  if (!ent) return NULL;
+
+  return table[ent->val];
+}
+
+
+/*
+ * The newest job, or if that one is buried already, the one with the
+ * highest number.
+ */
+int job_last(void) {
+  if (latest >= 0 && latest < used && table[latest]) return latest;
+
+  return used - 1;
+}
+
+
+int job_max(void) {
+  return used;
+}
+
+
+static void timeval_add(struct timeval* a, struct timeval* b) {
+  a->tv_sec += b->tv_sec;
+  a->tv_usec += b->tv_usec;
+
+  if (a->tv_usec >= 1000000) {
+    a->tv_sec++;
+    a->tv_usec -= 1000000;
+  }
+}
+
+
+static void rusage_add(struct rusage* a, struct rusage* b) {
+  timeval_add(&a->ru_utime, &b->ru_utime);
+  timeval_add(&a->ru_stime, &b->ru_stime);
+
+  if (b->ru_maxrss > a->ru_maxrss) {
+    a->ru_maxrss = b->ru_maxrss;
+  }
+
+  a->ru_minflt += b->ru_minflt;
+  a->ru_majflt += b->ru_majflt;
+  a->ru_inblock += b->ru_inblock;
+  a->ru_oublock += b->ru_oublock;
+  a->ru_nvcsw += b->ru_nvcsw;
+  a->ru_nivcsw += b->ru_nivcsw;
+}
+
+
+void job_account(job_t* job, struct rusage* ru) {
+  if (job) {
+    rusage_add(&job->usage, ru);
+  }
+
+  rusage_add(&job_usage, ru);
+}
+
+
+/*
+ * The exit status, or 128 plus the signal number; -1 if the process
+ * has only stopped.
+ */
+static int stat_value(int stat) {
+  if (WIFEXITED(stat)) {
+    return WEXITSTATUS(stat);
+
+  } else if (WIFSIGNALED(stat)) {
+    return 128 + WTERMSIG(stat);
+  }
+
+  return -1;
+}
+
+
+void job_expect(pid_t pid) {
+  map_put(&exits, pid, JOB_PENDING);
+}
+
+
+void job_forget(pid_t pid) {
+  pid_entry* ent = map_find(&exits, pid);
+
+  if (ent) {
+    map_del(&exits, ent);
+  }
+}
+
+
+void job_exited(pid_t pid, int stat) {
+  pid_entry* ent;
+
+  if (stat_value(stat) < 0) return;
+
+  ent = map_find(&exits, pid);
+
+  if (ent) {
+    ent->val = stat_value(stat);
+  }
+}
+
+
+/*
+ * Everything that has to happen when a child is reaped.
+ */
+static void job_reaped(pid_t pid, int stat, struct rusage* ru) {
+  job_t* job = job_by_pid(pid);
+
+  job_account(job, ru);
+  job_exited(pid, stat);
+
+  if (!job) return;
+
+  show_status(job, stat);
+
+  if (job->status == JOB_DEAD) {
+    kill(-job->pgid, SIGPIPE);
+
+    /* Whatever of the rest is gone already still counts. */
+    while (wait4(-job->pgid, &stat, WNOHANG, ru) > 0) {
+      job_account(job, ru);
+    }
+  }
+}
+
+
+void job_reap(void) {
+  struct rusage ru;
+  pid_t pid;
+  int stat;
+
+#ifdef __linux__
+  struct signalfd_siginfo info;
+  int any = 0;
+
+  if (sig_fd >= 0) {
+    while (read(sig_fd, &info, sizeof(info)) == sizeof(info)) {
+      any = 1;
+    }
+
+    /* No news is good news. */
+    if (!any) return;
+  }
+#endif
+
+  while ((pid = wait4(-1, &stat, WNOHANG | WUNTRACED, &ru)) > 0) {
+    job_reaped(pid, stat, &ru);
+  }
+}
+
+
+int job_poll(pid_t pid) {
+  pid_entry* ent = map_find(&exits, pid);
+  struct rusage ru;
+  pid_t tmp;
+  int stat;
+
+  if (ent && ent->val != JOB_PENDING) return ent->val;
+
+  while ((tmp = wait4(pid, &stat, WNOHANG, &ru)) < 0 && errno == EINTR) {
+    /* Nothing. */
+  }
+
+  if (tmp > 0) {
+    job_reaped(pid, stat, &ru);
+    return stat_value(stat);
+
+  } else if (tmp == 0) {
+    return JOB_PENDING;
+  }
+
+  return -1;
+}
+
+
+/*
+ * A descriptor that becomes readable when the process quits, or -1.
+ */
+static int pid_fd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  return -1;
+#endif
+}
+
+
+static long millis_since(struct timeval* t0) {
+  struct timeval t1;
+
+  gettimeofday(&t1, NULL);
+
+  return (t1.tv_sec - t0->tv_sec) * 1000 +
+    (t1.tv_usec - t0->tv_usec) / 1000;
+}
+
+
+int job_await(pid_t* pid, int* status, int n, int all, long millis) {
+  struct pollfd* pfds;
+  struct timeval t0;
+  int* fds;
+  int done, k, i;
+  int blind;
+  long left;
+
+  gettimeofday(&t0, NULL);
+
+  fds = (int*)gc_alloc(sizeof(int) * n, "job_await");
+  pfds = (struct pollfd*)gc_alloc(sizeof(struct pollfd) * n, "job_await");
+
+  for (i = 0; i < n; i++) {
+    fds[i] = -1;
+  }
+
+  while (1) {
+    done = 0;
+    k = 0;
+    blind = 0;
+
+    for (i = 0; i < n; i++) {
+      if (status[i] == JOB_PENDING) {
+	status[i] = job_poll(pid[i]);
+      }
+
+      if (status[i] != JOB_PENDING) {
+	done++;
+	continue;
+      }
+
+      if (fds[i] < 0) {
+	fds[i] = pid_fd(pid[i]);
+      }
+
+      if (fds[i] < 0) {
+	blind = 1;
+	continue;
+      }
+
+      pfds[k].fd = fds[i];
+      pfds[k].events = POLLIN;
+      pfds[k].revents = 0;
+      k++;
+    }
+
+    if (all ? done == n : done > 0) break;
+
+    if (exception_flag) {
+      done = -1;
+      break;
+    }
+
+    left = -1;
+
+    if (millis >= 0) {
+      left = millis - millis_since(&t0);
+
+      if (left <= 0) break;
+    }
+
+    /* Without a descriptor for each process, look again now and then. */
+    if (blind && (left < 0 || left > 10)) {
+      left = 10;
+    }
+
+    poll(pfds, k, left);
+  }
+
+  for (i = 0; i < n; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+
+  gc_free(fds);
+  gc_free(pfds);
+
+  return done;
+}
+
+
+int job_linger(pid_t pid, long millis) {
+  struct pollfd pfd;
+  struct timeval t0;
+  siginfo_t info;
+  long left;
+  int ret = 0;
+
+  gettimeofday(&t0, NULL);
+
+  pfd.fd = pid_fd(pid);
+  pfd.events = POLLIN;
+
+  while (1) {
+    info.si_pid = 0;
+
+    /* Gone already, or not ours: let the caller find out. */
+    if (waitid(P_PID, pid, &info,
+	       WEXITED | WSTOPPED | WNOHANG | WNOWAIT) < 0 ||
+	info.si_pid) {
+
+      ret = 1;
+      break;
+    }
+
+    if (exception_flag) break;
+
+    left = millis - millis_since(&t0);
+
+    if (left <= 0) break;
+
+    /* A stop doesn't make the descriptor readable, so look again. */
+    if ((pfd.fd < 0 || interactive) && left > 50) {
+      left = (pfd.fd < 0 ? 10 : 50);
+    }
+
+    pfd.revents = 0;
+    poll(&pfd, (pfd.fd >= 0 ? 1 : 0), left);
+  }
+
+  if (pfd.fd >= 0) {
+    close(pfd.fd);
+  }
+
+  return ret;
+}
+
+
+void job_bury(void) {
+  pid_entry* ent;
+  job_t* job;
+  int id;
+
+  for (id = 0; id < used; id++) {
+    job = table[id];
+
+    if (!job || job->status != JOB_DEAD) continue;
+
+    ent = map_find(&pids, job->last_pid);
+
+    /* The PID might belong to a newer job already. */
+    if (ent && ent->val == id) {
+      map_del(&pids, ent);
+    }
+
+    gc_free(job->name);
+    gc_free(job);
+
+    table[id] = NULL;
+
+    if (id < hint) {
+      hint = id;
+    }
+  }
+
+  while (used && !table[used - 1]) {
+    used--;
+  }
+}
+
+
+void job_done(void) {
+  int id;
+
+  for (id = 0; id < used; id++) {
+    if (table[id]) {
+      gc_free(table[id]->name);
+      gc_free(table[id]);
+    }
+  }
+
+  if (table) {
+    gc_free(table);
+  }
+
+  map_free(&pids);
+  map_free(&exits);
+
+  table = NULL;
+  slots = used = hint = 0;
+  latest = -1;
+
+  if (sig_fd >= 0) {
+    close(sig_fd);
+  }
+
+  sig_fd = -1;
+}
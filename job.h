@@ -8,21 +8,84 @@
 #define __job_h__
 
 #include <termios.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+ * The job table: an array of jobs indexed by job number, plus an index
+ * from the last PID of each job to its number. Children are reaped from
+ * the main loop, not from a signal handler.
+ *
+ * Pitfalls:
+ *
+ *  + Job numbers are the ones "(jobs)" shows. They stay the same while
+ *    the job is alive, and are reused after its funeral.
+ *  + "job_watch" blocks SIGCHLD in the shell; every new process has to
+ *    unblock it, or it never hears about its own children.
+ *  + "job_reap" reaps every child that has changed state, with
+ *    "wait4(-1, ...)". Whoever waits for a job of their own has to
+ *    check whether it is JOB_DEAD already when "waitpid" fails.
+ *  + "job_bury" frees the dead jobs; "job_t" pointers to them are
+ *    dangling afterwards.
+ *  + "job_get" and "job_by_pid" return NULL if there is no such job.
+ *    "job_last" returns -1 if there are no jobs at all.
+ *  + The exit status of a background process is kept after it has been
+ *    reaped, between "job_expect" and "job_forget", so that "job_poll"
+ *    and "job_await" can still tell it. They return JOB_PENDING for a
+ *    process still running, and -1 for one they know nothing about.
+ *    "job_await" returns how many processes are done, or -1 if it was
+ *    interrupted; a negative "millis" means to wait for as long as it
+ *    takes.
+ *  + "job_linger" waits for a process to quit or stop without reaping
+ *    it, for at most "millis". It returns 0 if the time ran out or it
+ *    was interrupted.
+ *  + Whatever reaps a child should pass its "wait4" figures on to
+ *    "job_account", with the job if it knows it, or NULL, and its
+ *    status on to "job_exited". "job_usage"
+ *    adds up every child reaped so far, except "ru_maxrss", which is
+ *    the largest. "job_procs" counts the processes started.
+ */
 
 #define JOB_RUNNING    0
 #define JOB_STOPPED    1
 #define JOB_DEAD       2
 
+#define JOB_PENDING    (-2)
+
 typedef struct job_t job_t;
 
 struct job_t {
   pid_t pgid;
   pid_t last_pid;
   char* name;
+  int id;
 
   char status;
   char value;
   struct termios terminal_modes;
+
+  int procs;
+  struct rusage usage;
 };
 
+extern struct rusage job_usage;
+extern long job_procs;
+
+extern void job_watch(void);
+extern int job_add(job_t* job);
+extern job_t* job_get(int id);
+extern job_t* job_by_pid(pid_t pid);
+extern int job_last(void);
+extern int job_max(void);
+extern void job_account(job_t* job, struct rusage* ru);
+extern void job_expect(pid_t pid);
+extern void job_forget(pid_t pid);
+extern void job_exited(pid_t pid, int stat);
+extern int job_poll(pid_t pid);
+extern int job_await(pid_t* pid, int* status, int n, int all, long millis);
+extern int job_linger(pid_t pid, long millis);
+extern void job_reap(void);
+extern void job_bury(void);
+extern void job_done(void);
+
 #endif /* !__job_h__ */
@@ -11,6 +11,9 @@
 #include "gc.h"
 #include "list.h"
 #include "hash.h"
+#include "stream.h"
+#include "coproc.h"
+#include "job.h"
 
 extern int stderr_handler_fd;
 
@@ -24,6 +27,14 @@ list* ls_cons(void* data, list* ls) {
   return nw;
 }
 
+void ls_next_set(list* ls, list* next) {
+  ls->next = next;
+}
+
+void ls_data_set(list* ls, void* data) {
+  ls->data = data;
+}
+
 void ls_type_set(list* ls, char type) {
   ls->type = type;
 }
@@ -67,11 +78,20 @@ void ls_free_all(list* ls) {
     break;
 
   case TYPE_STRING:
-  case TYPE_PROC:
     if (ls->data)
       gc_free(ls->data);
     break;
 
+  case TYPE_PROC:
+    if (ls->data) {
+      if (gc_refs(ls->data) == 1) {
+	job_forget(*(pid_t*)ls->data);
+      }
+
+      gc_free(ls->data);
+    }
+    break;
+
   case TYPE_FD:
     if (gc_refs(ls->data) == 1) {
       int* fd = ls->data;
@@ -99,6 +119,22 @@ void ls_free_all(list* ls) {
     gc_free(ls->data);
     break;
 
+  case TYPE_STREAM:
+    if (gc_refs(ls->data) == 1) {
+      stream_close(ls->data);
+    }
+
+    gc_free(ls->data);
+    break;
+
+  case TYPE_COPROC:
+    if (gc_refs(ls->data) == 1) {
+      coproc_hangup(ls->data);
+    }
+
+    gc_free(ls->data);
+    break;
+
   case TYPE_VOID:
   case TYPE_BOOL:
     break;
@@ -133,6 +169,65 @@ list* ls_reverse(list* ls) {
   return ret;
 }
 
+/*
+ * Lists can be built in order by keeping a pointer to the last node.
+ * The node is linked after "*tail" (or becomes "*head" if the list is
+ * empty), and its "next" is cleared.
+ */
+void ls_append(list** head, list** tail, list* nw) {
+  nw->next = NULL;
+
+  if (*tail) {
+    (*tail)->next = nw;
+  } else {
+    (*head) = nw;
+  }
+
+  (*tail) = nw;
+}
+
+/*
+ * Ownership transfer. "ls_take" unlinks the first node of "*ls" and
+ * hands it over to the caller; "ls_move" hands over the whole list.
+ * In both cases the data is not copied, and "*ls" no longer owns what
+ * was taken. (A node that is shared with other lists cannot be
+ * unlinked, so "ls_take" gives out a new node in its place.)
+ */
+list* ls_take(list** ls) {
+  list* ret = (*ls);
+  list* nw;
+
+  if (!ret) return NULL;
+
+  (*ls) = ret->next;
+
+  if (gc_refs(ret) > 1) {
+    nw = ls_cons(ret->data, NULL);
+    nw->type = ret->type;
+    nw->flag = ret->flag;
+
+    gc_free(ret);
+    return nw;
+  }
+
+  ret->next = NULL;
+
+  return ret;
+}
+
+void ls_push(list** ls, list* nw) {
+  nw->next = (*ls);
+  (*ls) = nw;
+}
+
+list* ls_move(list** ls) {
+  list* ret = (*ls);
+
+  (*ls) = NULL;
+
+  return ret;
+}
+
 inline list* ls_next(list* ls) {
   return ls->next;
 }
@@ -157,6 +252,8 @@ list* ls_copy(list* arg) {
     case TYPE_STRING:
     case TYPE_FD:
     case TYPE_PROC:
+    case TYPE_STREAM:
+    case TYPE_COPROC:
       gc_inc_ref(ls_data(arg));
       break;
 
@@ -173,3 +270,40 @@ list* ls_copy(list* arg) {
 
   return ret;
 }
+
+
+/*
+ * Turn a list whose nodes only borrow their data into a list that owns
+ * it. Unlike "ls_copy", the nodes themselves are not shared.
+ */
+list* ls_claim(list* arg) {
+  list* iter;
+
+  for (iter = arg; iter != NULL; iter = ls_next(iter)) {
+
+    switch (ls_type(iter)) {
+    case TYPE_LIST:
+      ls_copy(ls_data(iter));
+      break;
+
+    case TYPE_STRING:
+    case TYPE_FD:
+    case TYPE_PROC:
+    case TYPE_STREAM:
+    case TYPE_COPROC:
+      gc_inc_ref(ls_data(iter));
+      break;
+
+    case TYPE_HASH:
+      hash_inc_ref(ls_data(iter));
+      gc_inc_ref(ls_data(iter));
+      break;
+
+    case TYPE_VOID:
+    case TYPE_BOOL:
+      break;
+    }
+  }
+
+  return arg;
+}
@@ -23,6 +23,13 @@
  *    the data before deleting the list node.
  *  + "ls_copy" and "ls_free_all" make lots of assumptions about type
  *     information.
+ *  + "ls_append" needs a pointer to the last node, you have to keep
+ *    track of it yourself.
+ *  + "ls_take" and "ls_move" transfer ownership without copying.
+ *    "ls_push" is the opposite of "ls_take".
+ *    "ls_claim" is for lists of fresh nodes that borrow their data,
+ *    it makes the nodes own the data.
+ *  + "ls_next_set" relinks a node; never use it on a shared node.
  */
 
 #define TYPE_STRING   0
@@ -32,6 +39,8 @@
 #define TYPE_FD       4
 #define TYPE_PROC     5
 #define TYPE_VOID     6
+#define TYPE_STREAM   7
+#define TYPE_COPROC   8
 
 #define FLAG_NONE     0
 
@@ -49,12 +58,19 @@ extern void ls_free_all(list* ls);
 extern void ls_free_shallow(list* ls);
 extern list* ls_reverse(list* ls);
 extern list* ls_cons(void* data, list* ls);
+extern void ls_append(list** head, list** tail, list* nw);
 extern list* ls_next(list* ls);
+extern void ls_next_set(list* ls, list* next);
 extern void* ls_data(list* ls);
+extern void ls_data_set(list* ls, void* data);
 extern void ls_type_set(list* ls, char type);
 extern char ls_type(list* ls);
 extern void ls_flag_set(list* ls, char flag);
 extern char ls_flag(list* ls);
 extern list* ls_copy(list* ls);
+extern list* ls_claim(list* ls);
+extern list* ls_take(list** ls);
+extern void ls_push(list** ls, list* nw);
+extern list* ls_move(list** ls);
 
 #endif /* !__list_h__ */
@@ -0,0 +1,224 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "list.h"
+#include "hash.h"
+#include "memo.h"
+
+
+memo* memo_new(int size, int ttl) {
+  memo* m = (memo*)gc_alloc(sizeof(memo), "memo_new");
+
+  m->size = size;
+  m->ttl = ttl;
+  m->count = 0;
+  m->newest = NULL;
+  m->oldest = NULL;
+
+  m->table = (hash_table*)gc_alloc(sizeof(hash_table), "memo_new");
+  hash_init(m->table, NULL);
+
+  return m;
+}
+
+
+static void memo_unlink(memo* m, memo_entry* e) {
+  if (e->newer) {
+    e->newer->older = e->older;
+
+  } else {
+    m->newest = e->older;
+  }
+
+  if (e->older) {
+    e->older->newer = e->newer;
+
+  } else {
+    m->oldest = e->newer;
+  }
+}
+
+
+static void memo_link(memo* m, memo_entry* e) {
+  e->newer = NULL;
+  e->older = m->newest;
+
+  if (m->newest) {
+    m->newest->newer = e;
+
+  } else {
+    m->oldest = e;
+  }
+
+  m->newest = e;
+}
+
+
+/*
+ * The key is freed by "hash_del".
+ */
+static void memo_drop(memo* m, memo_entry* e) {
+  memo_unlink(m, e);
+
+  hash_del(m->table, e->key);
+  ls_free_all(e->value);
+  gc_free(e);
+
+  m->count--;
+}
+
+
+void memo_clear(memo* m) {
+  while (m->oldest) {
+    memo_drop(m, m->oldest);
+  }
+}
+
+
+void memo_free(memo* m) {
+  /* Still in use by a call; the last one out frees it. */
+  if (gc_refs(m) > 1) {
+    gc_free(m);
+    return;
+  }
+
+  memo_clear(m);
+
+  hash_free(m->table, NULL);
+  gc_free(m->table);
+  gc_free(m);
+}
+
+
+/*
+ * Strings are written with their length in front, so that no
+ * character in a string can be confused with the structure.
+ * Returns the length of the key, or -1 if "ls" can't be a key.
+ */
+static int memo_key_aux(list* ls, char* buff) {
+  int len = 0;
+  int tmp;
+
+  for (; ls != NULL; ls = ls_next(ls)) {
+    switch (ls_type(ls)) {
+    case TYPE_STRING:
+      tmp = strlen(ls_data(ls));
+
+      if (buff) {
+	len += sprintf(buff + len, "%d:", tmp);
+	memcpy(buff + len, ls_data(ls), tmp);
+
+      } else {
+	len += snprintf(NULL, 0, "%d:", tmp);
+      }
+
+      len += tmp;
+      break;
+
+    case TYPE_BOOL:
+      if (buff) buff[len] = (ls_data(ls) ? 't' : 'f');
+      len++;
+      break;
+
+    case TYPE_VOID:
+      if (buff) buff[len] = 'v';
+      len++;
+      break;
+
+    case TYPE_LIST:
+      if (buff) buff[len] = '(';
+      len++;
+
+      tmp = memo_key_aux(ls_data(ls), (buff ? buff + len : NULL));
+
+      if (tmp < 0) return -1;
+
+      len += tmp;
+
+      if (buff) buff[len] = ')';
+      len++;
+      break;
+
+    default:
+      return -1;
+    }
+  }
+
+  return len;
+}
+
+
+char* memo_key(list* args) {
+  int len = memo_key_aux(args, NULL);
+  char* ret;
+
+  if (len < 0) return NULL;
+
+  ret = (char*)gc_alloc(sizeof(char) * (len + 1), "memo_key");
+
+  memo_key_aux(args, ret);
+  ret[len] = '\0';
+
+  return ret;
+}
+
+
+int memo_get(memo* m, char* key, list** value) {
+  memo_entry* e = hash_get(m->table, key);
+
+  if (!e) return 0;
+
+  if (m->ttl && time(NULL) - e->stamp >= m->ttl) {
+    memo_drop(m, e);
+    return 0;
+  }
+
+  memo_unlink(m, e);
+  memo_link(m, e);
+
+  (*value) = e->value;
+
+  return 1;
+}
+
+
+void memo_put(memo* m, char* key, list* value) {
+  memo_entry* e;
+
+  if (memo_key_aux(value, NULL) < 0) {
+    gc_free(key);
+    ls_free_all(value);
+    return;
+  }
+
+  e = hash_get(m->table, key);
+
+  if (e) {
+    memo_drop(m, e);
+  }
+
+  if (m->size && m->count >= m->size) {
+    memo_drop(m, m->oldest);
+  }
+
+  e = (memo_entry*)gc_alloc(sizeof(memo_entry), "memo_put");
+
+  e->key = key;
+  e->value = value;
+  e->stamp = time(NULL);
+
+  hash_put(m->table, key, e);
+  memo_link(m, e);
+
+  m->count++;
+}
@@ -0,0 +1,57 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __memo_h__
+#define __memo_h__
+
+/*
+ * A cache of return values, for commands created with "define-memo".
+ * The arguments of a call are turned into a string key with "memo_key",
+ * and the return value is stored under that key.
+ *
+ * Pitfalls:
+ *
+ *  + "memo_key" returns NULL if the arguments cannot be used as a key,
+ *    i.e. if they contain anything other than strings, booleans and lists.
+ *  + "memo_get" returns the cached list itself, not a copy. It returns
+ *    zero if there was nothing cached under the key (an empty list is
+ *    a perfectly good return value).
+ *  + "memo_put" takes over the key and the value, even if it decides not
+ *    to cache them.
+ *  + A size of zero means no limit, and so does a time-to-live of zero.
+ *    When the cache is full, the least recently used value is dropped.
+ *  + A memo can be referenced with "gc_inc_ref" while it is in use;
+ *    "memo_free" then only drops a reference, until the last one.
+ */
+
+typedef struct memo memo;
+typedef struct memo_entry memo_entry;
+
+struct memo_entry {
+  char* key;
+  list* value;
+  time_t stamp;
+  memo_entry* newer;
+  memo_entry* older;
+};
+
+struct memo {
+  int size;
+  int ttl;
+  int count;
+  hash_table* table;
+  memo_entry* newest;
+  memo_entry* oldest;
+};
+
+extern memo* memo_new(int size, int ttl);
+extern void memo_free(memo* m);
+extern void memo_clear(memo* m);
+extern char* memo_key(list* args);
+extern int memo_get(memo* m, char* key, list** value);
+extern void memo_put(memo* m, char* key, list* value);
+
+#endif /* !__memo_h__ */
@@ -0,0 +1,719 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "format.h"
+#include "list.h"
+#include "hash.h"
+#include "job.h"
+#include "token.h"
+#include "esh.h"
+#include "path.h"
+#include "native.h"
+
+#define NATIVE_BLOCK 65536
+
+
+typedef int (*native_func)(int argc, char** argv);
+
+typedef struct native_entry native_entry;
+
+struct native_entry {
+  char* name;
+  native_func func;
+};
+
+
+static int in_fd;
+static int out_fd;
+static int err_fd;
+
+
+/*
+ * Returns -1 if not everything could be written.
+ */
+static int native_write(int fd, char* data, int len) {
+  int tmp;
+
+  while (len > 0) {
+    tmp = write(fd, data, len);
+
+    if (tmp < 0) {
+      if (errno == EINTR) continue;
+
+      return -1;
+    }
+
+    data += tmp;
+    len -= tmp;
+  }
+
+  return 0;
+}
+
+static int native_puts(char* str) {
+  return native_write(out_fd, str, strlen(str));
+}
+
+static void native_error(char* fmt, ...) {
+  char buff[1024];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(buff, sizeof(buff), fmt, ap);
+  va_end(ap);
+
+  native_write(err_fd, buff, strlen(buff));
+}
+
+
+/*
+ * The "-" and the usual option letters, as in "-nE". Returns 0 if "arg"
+ * is not made only of letters from "opts".
+ */
+static int native_opts(char* arg, char* opts) {
+  int i;
+
+  if (arg[0] != '-' || !arg[1]) return 0;
+
+  for (i = 1; arg[i]; i++) {
+    if (!strchr(opts, arg[i])) return 0;
+  }
+
+  return 1;
+}
+
+static int native_is_opt(char* arg) {
+  return (arg[0] == '-' && arg[1]);
+}
+
+/*
+ * Only regular files are read here: anything else could block in a
+ * read that can't be interrupted, or never end. The real command can
+ * be stopped, so it gets those.
+ */
+static int native_regular(int fd) {
+  struct stat st;
+
+  return (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+}
+
+/*
+ * The same for a file named on the command line. A file that can't be
+ * looked at is fine here, opening it will report the error.
+ */
+static int native_regular_file(char* file) {
+  struct stat st;
+
+  if (strcmp(file, "-") == 0) return native_regular(in_fd);
+
+  return (stat(file, &st) < 0 || S_ISREG(st.st_mode));
+}
+
+static int native_open(char* file) {
+  if (strcmp(file, "-") == 0) return in_fd;
+
+  return open(file, O_RDONLY);
+}
+
+static void native_close(int fd) {
+  if (fd != in_fd) close(fd);
+}
+
+
+static int native_echo(int argc, char** argv) {
+  int newline = 1;
+  int escapes = 0;
+  int i, j;
+  char c;
+
+  if (argc == 2 &&
+      (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "--version") == 0)) {
+    return NATIVE_DECLINE;
+  }
+
+  for (i = 1; i < argc && native_opts(argv[i], "neE"); i++) {
+    for (j = 1; argv[i][j]; j++) {
+      switch (argv[i][j]) {
+      case 'n': newline = 0; break;
+      case 'e': escapes = 1; break;
+      case 'E': escapes = 0; break;
+      }
+    }
+  }
+
+  for (; i < argc; i++) {
+    if (!escapes) {
+      if (native_puts(argv[i])) return 1;
+
+    } else {
+      char* s = argv[i];
+
+      for (j = 0; s[j]; j++) {
+	c = s[j];
+
+	if (c == '\\' && s[j+1]) {
+	  j++;
+
+	  switch (s[j]) {
+	  case 'a':  c = '\a'; break;
+	  case 'b':  c = '\b'; break;
+	  case 'e':  c = 27;   break;
+	  case 'f':  c = '\f'; break;
+	  case 'n':  c = '\n'; break;
+	  case 'r':  c = '\r'; break;
+	  case 't':  c = '\t'; break;
+	  case 'v':  c = '\v'; break;
+	  case '\\': c = '\\'; break;
+
+	  case 'c':
+	    return 0;
+
+	  case '0':
+	    {
+	      int k;
+
+	      c = 0;
+
+	      for (k = 0; k < 3 && s[j+1] >= '0' && s[j+1] <= '7'; k++) {
+		c = c * 8 + (s[++j] - '0');
+	      }
+	    }
+	    break;
+
+	  case 'x':
+	    if (!isxdigit((unsigned char)s[j+1])) {
+	      j--;
+	      break;
+	    }
+
+	    {
+	      int k;
+
+	      c = 0;
+
+	      for (k = 0; k < 2 && isxdigit((unsigned char)s[j+1]); k++) {
+		j++;
+		c = c * 16 + (isdigit((unsigned char)s[j]) ? s[j] - '0' :
+			      (tolower((unsigned char)s[j]) - 'a' + 10));
+	      }
+	    }
+	    break;
+
+	  default:
+	    /* Not an escape after all. */
+	    j--;
+	    break;
+	  }
+	}
+
+	if (native_write(out_fd, &c, 1)) return 1;
+      }
+    }
+
+    if (i < argc - 1 && native_puts(" ")) return 1;
+  }
+
+  if (newline && native_puts("\n")) return 1;
+
+  return 0;
+}
+
+
+static int native_true(int argc, char** argv) {
+  if (argc == 2 && strncmp(argv[1], "--", 2) == 0) return NATIVE_DECLINE;
+
+  return 0;
+}
+
+static int native_false(int argc, char** argv) {
+  if (argc == 2 && strncmp(argv[1], "--", 2) == 0) return NATIVE_DECLINE;
+
+  return 1;
+}
+
+
+static int native_copy(int fd) {
+  char buff[NATIVE_BLOCK];
+  int len;
+
+  while (!exception_flag) {
+    len = read(fd, buff, sizeof(buff));
+
+    if (len < 0 && errno == EINTR) continue;
+    if (len <= 0) return len;
+
+    if (native_write(out_fd, buff, len)) return -1;
+  }
+
+  return -1;
+}
+
+static int native_cat(int argc, char** argv) {
+  int ret = 0;
+  int fd;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (native_is_opt(argv[i])) return NATIVE_DECLINE;
+
+    if (!native_regular_file(argv[i])) return NATIVE_DECLINE;
+  }
+
+  if (argc == 1) {
+    if (!native_regular(in_fd)) return NATIVE_DECLINE;
+
+    return (native_copy(in_fd) < 0);
+  }
+
+  for (i = 1; i < argc; i++) {
+    fd = native_open(argv[i]);
+
+    if (fd < 0) {
+      native_error("cat: %s: %s\n", argv[i], strerror(errno));
+      ret = 1;
+      continue;
+    }
+
+    if (native_copy(fd) < 0) {
+      if (errno == EPIPE || exception_flag) {
+	native_close(fd);
+	return 1;
+      }
+
+      native_error("cat: %s: %s\n", argv[i], strerror(errno));
+      ret = 1;
+    }
+
+    native_close(fd);
+  }
+
+  return ret;
+}
+
+
+/*
+ * A plain count, with no suffixes.
+ */
+static int native_count(char* str, long* ret) {
+  char* end;
+
+  if (!isdigit((unsigned char)str[0])) return 0;
+
+  errno = 0;
+  (*ret) = strtol(str, &end, 10);
+
+  return (!*end && !errno);
+}
+
+static int native_head(int argc, char** argv) {
+  char buff[NATIVE_BLOCK];
+  long lines = 10;
+  char* file = NULL;
+  int fd;
+  int len;
+  int i;
+  int ret = 0;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      if (!native_count(argv[++i], &lines)) return NATIVE_DECLINE;
+
+    } else if (strncmp(argv[i], "-n", 2) == 0) {
+      if (!native_count(argv[i] + 2, &lines)) return NATIVE_DECLINE;
+
+    } else if (argv[i][0] == '-' && isdigit((unsigned char)argv[i][1])) {
+      if (!native_count(argv[i] + 1, &lines)) return NATIVE_DECLINE;
+
+    } else if (native_is_opt(argv[i]) || file) {
+      /* Other options, or headers for several files. */
+      return NATIVE_DECLINE;
+
+    } else {
+      file = argv[i];
+    }
+  }
+
+  if (!file) file = "-";
+
+  if (!native_regular_file(file)) return NATIVE_DECLINE;
+
+  fd = native_open(file);
+
+  if (fd < 0) {
+    native_error("head: cannot open '%s' for reading: %s\n", file,
+		 strerror(errno));
+    return 1;
+  }
+
+  while (lines > 0 && !exception_flag) {
+    len = read(fd, buff, sizeof(buff));
+
+    if (len < 0 && errno == EINTR) continue;
+
+    if (len < 0) {
+      native_error("head: error reading '%s': %s\n", file, strerror(errno));
+      ret = 1;
+      break;
+    }
+
+    if (!len) break;
+
+    for (i = 0; i < len && lines > 0; i++) {
+      if (buff[i] == '\n') lines--;
+    }
+
+    if (native_write(out_fd, buff, i)) {
+      ret = 1;
+      break;
+    }
+
+    /* Leave the rest for whoever reads the file next, as head does. */
+    if (i < len) {
+      lseek(fd, i - len, SEEK_CUR);
+    }
+  }
+
+  if (exception_flag) {
+    ret = 1;
+  }
+
+  native_close(fd);
+
+  return ret;
+}
+
+
+static int native_wc(int argc, char** argv) {
+  char buff[NATIVE_BLOCK];
+  char num[64];
+  long lines = 0;
+  char* file = NULL;
+  int fd;
+  int len;
+  int i;
+
+  if (argc < 2 || argc > 3 || strcmp(argv[1], "-l") != 0) {
+    return NATIVE_DECLINE;
+  }
+
+  if (argc == 3) {
+    if (native_is_opt(argv[2])) return NATIVE_DECLINE;
+
+    file = argv[2];
+  }
+
+  if (!native_regular_file(file ? file : "-")) {
+    return NATIVE_DECLINE;
+  }
+
+  fd = (file ? native_open(file) : in_fd);
+
+  if (fd < 0) {
+    native_error("wc: %s: %s\n", file, strerror(errno));
+    return 1;
+  }
+
+  while (!exception_flag) {
+    len = read(fd, buff, sizeof(buff));
+
+    if (len < 0 && errno == EINTR) continue;
+
+    if (len < 0) {
+      native_error("wc: %s: %s\n", (file ? file : "-"), strerror(errno));
+      native_close(fd);
+      return 1;
+    }
+
+    if (!len) break;
+
+    for (i = 0; i < len; i++) {
+      if (buff[i] == '\n') lines++;
+    }
+  }
+
+  native_close(fd);
+
+  if (exception_flag) return 1;
+
+  if (file) {
+    snprintf(num, sizeof(num), "%ld ", lines);
+
+    if (native_puts(num) || native_puts(file) || native_puts("\n")) {
+      return 1;
+    }
+
+  } else {
+    snprintf(num, sizeof(num), "%ld\n", lines);
+
+    if (native_puts(num)) return 1;
+  }
+
+  return 0;
+}
+
+
+static int native_basename(int argc, char** argv) {
+  char* name;
+  char* suffix;
+  int len;
+  int slen;
+  int start;
+
+  if (argc < 2 || argc > 3 || native_is_opt(argv[1])) {
+    return NATIVE_DECLINE;
+  }
+
+  name = argv[1];
+  suffix = (argc == 3 ? argv[2] : "");
+
+  len = strlen(name);
+
+  while (len > 1 && name[len-1] == '/') len--;
+
+  if (len == 1 && name[0] == '/') {
+    return (native_puts("/\n") != 0);
+  }
+
+  start = len;
+
+  while (start > 0 && name[start-1] != '/') start--;
+
+  slen = strlen(suffix);
+
+  if (slen && slen < len - start &&
+      strncmp(name + len - slen, suffix, slen) == 0) {
+    len -= slen;
+  }
+
+  if (native_write(out_fd, name + start, len - start) ||
+      native_puts("\n")) {
+    return 1;
+  }
+
+  return 0;
+}
+
+
+static int native_dirname(int argc, char** argv) {
+  char* name;
+  int len;
+  int i;
+
+  if (argc < 2) return NATIVE_DECLINE;
+
+  for (i = 1; i < argc; i++) {
+    if (native_is_opt(argv[i])) return NATIVE_DECLINE;
+  }
+
+  for (i = 1; i < argc; i++) {
+    name = argv[i];
+    len = strlen(name);
+
+    while (len > 1 && name[len-1] == '/') len--;
+    while (len > 0 && name[len-1] != '/') len--;
+
+    if (!len) {
+      if (native_puts(".\n")) return 1;
+      continue;
+    }
+
+    while (len > 1 && name[len-1] == '/') len--;
+
+    if (native_write(out_fd, name, len) || native_puts("\n")) return 1;
+  }
+
+  return 0;
+}
+
+
+static int native_mkdir_p(char* dir) {
+  struct stat st;
+  char* tmp;
+  int len = strlen(dir);
+  int i;
+  int ret = 0;
+
+  tmp = (char*)malloc(len + 1);
+  strcpy(tmp, dir);
+
+  for (i = 1; i <= len && !ret; i++) {
+    if (tmp[i] != '/' && tmp[i] != '\0') continue;
+
+    tmp[i] = '\0';
+
+    if (mkdir(tmp, 0777) < 0 &&
+	!(errno == EEXIST && stat(tmp, &st) == 0 && S_ISDIR(st.st_mode))) {
+
+      if (errno == EEXIST) errno = ENOTDIR;
+
+      native_error("mkdir: cannot create directory '%s': %s\n", tmp,
+		   strerror(errno));
+      ret = -1;
+    }
+
+    if (i < len) tmp[i] = '/';
+  }
+
+  free(tmp);
+
+  return ret;
+}
+
+static int native_mkdir(int argc, char** argv) {
+  int parents = 0;
+  int ret = 0;
+  int i = 1;
+
+  if (argc > 1 && native_opts(argv[1], "p")) {
+    parents = 1;
+    i++;
+  }
+
+  if (i >= argc) return NATIVE_DECLINE;
+
+  for (; i < argc; i++) {
+    if (native_is_opt(argv[i])) return NATIVE_DECLINE;
+  }
+
+  for (i = (parents ? 2 : 1); i < argc; i++) {
+    if (parents) {
+      if (native_mkdir_p(argv[i]) < 0) ret = 1;
+
+    } else if (mkdir(argv[i], 0777) < 0) {
+      native_error("mkdir: cannot create directory '%s': %s\n", argv[i],
+		   strerror(errno));
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
+
+static int native_rm(int argc, char** argv) {
+  int force = 0;
+  int ret = 0;
+  int i = 1;
+
+  if (argc > 1 && native_opts(argv[1], "f")) {
+    force = 1;
+    i++;
+  }
+
+  if (i >= argc && !force) return NATIVE_DECLINE;
+
+  for (; i < argc; i++) {
+    if (native_is_opt(argv[i])) return NATIVE_DECLINE;
+  }
+
+  for (i = (force ? 2 : 1); i < argc; i++) {
+    if (unlink(argv[i]) < 0) {
+      if (force && errno == ENOENT) continue;
+
+      native_error("rm: cannot remove '%s': %s\n", argv[i], strerror(errno));
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
+
+static native_entry native_array[] = {
+  { "echo",     native_echo },
+  { "true",     native_true },
+  { "false",    native_false },
+  { "cat",      native_cat },
+  { "head",     native_head },
+  { "wc",       native_wc },
+  { "basename", native_basename },
+  { "dirname",  native_dirname },
+  { "mkdir",    native_mkdir },
+  { "rm",       native_rm },
+  { NULL, NULL }
+};
+
+
+/*
+ * The directories of the system's own versions of these commands.
+ */
+static char* native_dirs[] = {
+  "/bin/",
+  "/usr/bin/",
+  NULL
+};
+
+
+/*
+ * Would "name" run the system's own version of the command? If PATH
+ * finds another one first, or none at all, that is what has to run.
+ */
+static int native_system_p(char* name) {
+  char* file = path_find(name);
+  int len;
+  int i;
+
+  if (!file) return 0;
+
+  for (i = 0; native_dirs[i]; i++) {
+    len = strlen(native_dirs[i]);
+
+    if (strncmp(file, native_dirs[i], len) == 0 &&
+	strcmp(file + len, name) == 0) {
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+int native_run(char** argv, int in, int out, int err) {
+  void (*oldsig)(int);
+  int argc = 0;
+  int ret;
+  int i;
+
+  for (i = 0; native_array[i].name; i++) {
+    if (strcmp(native_array[i].name, argv[0]) == 0) break;
+  }
+
+  if (!native_array[i].name || !native_system_p(argv[0])) {
+    return NATIVE_DECLINE;
+  }
+
+  while (argv[argc]) argc++;
+
+  in_fd = in;
+  out_fd = out;
+  err_fd = err;
+
+  /* What the shell printed must come out first. */
+  fflush(stdout);
+
+  /* A closed pipe should fail the command, not kill the shell. */
+  oldsig = signal(SIGPIPE, SIG_IGN);
+
+  ret = native_array[i].func(argc, argv);
+
+  signal(SIGPIPE, oldsig);
+
+  return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __native_h__
+#define __native_h__
+
+/*
+ * Versions of a few small utilities (echo, true, false, cat, head,
+ * wc -l, basename, dirname, mkdir and rm) that run inside the shell,
+ * so that running them doesn't cost a process.
+ *
+ * Pitfalls:
+ *
+ *  + "native_run" returns the exit status, or NATIVE_DECLINE if the
+ *    command isn't one of these, or uses options that aren't handled
+ *    here. The real command should be run then; it will do the right
+ *    thing, including printing the error messages.
+ *  + A command is only run here when PATH finds it in /bin or
+ *    /usr/bin, so a version of the user's own still gets to run.
+ *  + Only the common cases are handled, and they behave like the GNU
+ *    versions.
+ *  + Only regular files are read; commands that would read a pipe,
+ *    a terminal or a device are declined, since a read could block
+ *    where Ctrl-C can't get to it. Reading stops on an interrupt.
+ *  + "head" puts back what it read past the last line, so a script
+ *    read from the same file goes on after it.
+ *  + The file descriptors are left open.
+ */
+
+#define NATIVE_DECLINE  -1
+
+extern int native_run(char** argv, int in_fd, int out_fd, int err_fd);
+
+#endif /* !__native_h__ */
@@ -0,0 +1,280 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "format.h"
+#include "list.h"
+#include "gc.h"
+#include "hash.h"
+#include "job.h"
+#include "token.h"
+#include "esh.h"
+#include "parallel.h"
+
+#define PARALLEL_BLOCK 4096
+
+
+typedef struct par_t par_t;
+
+struct par_t {
+  pid_t last_pid;
+  job_t* job;
+  int fd;
+  int status;
+
+  char* out;
+  int len;
+  int size;
+};
+
+
+static void par_start(par_t* p, list* spec, int null_fd) {
+  int pfd[2];
+  int in_fd = null_fd;
+  pid_t pid;
+
+  if (spec && ls_type(spec) == TYPE_FD) {
+    in_fd = ((int*)ls_data(spec))[0];
+    spec = ls_next(spec);
+  }
+
+  if (pipe(pfd)) {
+    error("esh: parallel: could not create a pipe.");
+    return;
+  }
+
+  fcntl(pfd[0], F_SETFD, 1);
+  fcntl(pfd[1], F_SETFD, 1);
+
+  pid = do_pipe(in_fd, pfd[1], spec, 1, 1);
+
+  if (pid <= 0) {
+    close(pfd[0]);
+    return;
+  }
+
+  p->last_pid = pid;
+  p->fd = pfd[0];
+
+  if (interactive) {
+    p->job = job_by_pid(pid);
+  }
+}
+
+
+static void par_reap(par_t* p) {
+  struct rusage ru;
+  int stat;
+  int tmp;
+
+  while (wait4(p->last_pid, &stat, 0, &ru) < 0) {
+    if (errno != EINTR) {
+      /* "job_reap" might have got there first. */
+      p->status = (p->job && p->job->status == JOB_DEAD ?
+		   p->job->value : -1);
+      return;
+    }
+  }
+
+  job_account(p->job, &ru);
+
+  if (WIFEXITED(stat)) {
+    p->status = WEXITSTATUS(stat);
+
+  } else if (WIFSIGNALED(stat)) {
+    p->status = 128 + WTERMSIG(stat);
+  }
+
+  if (p->job) {
+    show_status(p->job, stat);
+
+    /* The rest of the pipeline. */
+    kill(-p->job->pgid, SIGPIPE);
+
+    while (wait4(-p->job->pgid, &tmp, 0, &ru) > 0) {
+      job_account(p->job, &ru);
+    }
+
+    p->job->status = JOB_DEAD;
+  }
+}
+
+
+/*
+ * Returns 0 at the end of the output.
+ */
+static int par_read(par_t* p) {
+  int n;
+
+  if (p->len + PARALLEL_BLOCK + 1 > p->size) {
+    char* tmp;
+
+    while (p->len + PARALLEL_BLOCK + 1 > p->size) {
+      p->size *= 2;
+    }
+
+    tmp = (char*)gc_alloc(sizeof(char) * p->size, "par_read");
+    memcpy(tmp, p->out, p->len);
+    gc_free(p->out);
+    p->out = tmp;
+  }
+
+  n = read(p->fd, p->out + p->len, PARALLEL_BLOCK);
+
+  if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 1;
+  if (n <= 0) return 0;
+
+  p->len += n;
+
+  return 1;
+}
+
+
+list* parallel_run(int limit, list* specs) {
+  par_t* pars;
+  struct pollfd* fds;
+  int* which;
+  list* iter;
+  list* ret = NULL;
+  int n = 0;
+  int next = 0;
+  int running = 0;
+  int null_fd;
+  int nfds;
+  int i;
+
+  for (iter = specs; iter != NULL; iter = ls_next(iter)) n++;
+
+  if (!n) return NULL;
+
+  if (limit < 1) limit = 1;
+
+  null_fd = open("/dev/null", O_RDONLY);
+
+  if (null_fd < 0) {
+    error("esh: parallel: cannot open /dev/null.");
+    return NULL;
+  }
+
+  fcntl(null_fd, F_SETFD, 1);
+
+  pars = (par_t*)gc_alloc(sizeof(par_t) * n, "parallel_run");
+  fds = (struct pollfd*)gc_alloc(sizeof(struct pollfd) * n, "parallel_run");
+  which = (int*)gc_alloc(sizeof(int) * n, "parallel_run");
+
+  for (i = 0; i < n; i++) {
+    pars[i].last_pid = 0;
+    pars[i].job = NULL;
+    pars[i].fd = -1;
+    pars[i].status = -1;
+    pars[i].len = 0;
+    pars[i].size = PARALLEL_BLOCK * 2;
+    pars[i].out = (char*)gc_alloc(sizeof(char) * pars[i].size,
+				  "parallel_run");
+  }
+
+  iter = specs;
+
+  while ((next < n || running) && !exception_flag) {
+
+    while (running < limit && next < n) {
+      if (ls_type(iter) == TYPE_LIST) {
+	par_start(&pars[next], ls_data(iter), null_fd);
+
+      } else {
+	error("esh: parallel: pipelines should be given as lists.");
+      }
+
+      if (pars[next].fd >= 0) running++;
+
+      next++;
+      iter = ls_next(iter);
+    }
+
+    nfds = 0;
+
+    for (i = 0; i < next; i++) {
+      if (pars[i].fd < 0) continue;
+
+      fds[nfds].fd = pars[i].fd;
+      fds[nfds].events = POLLIN;
+      fds[nfds].revents = 0;
+      which[nfds++] = i;
+    }
+
+    if (!nfds) continue;
+
+    if (poll(fds, nfds, -1) < 0) {
+      if (errno == EINTR) continue;
+
+      error("esh: parallel: poll failed.");
+      break;
+    }
+
+    for (i = 0; i < nfds; i++) {
+      par_t* p = &pars[which[i]];
+
+      if (!fds[i].revents) continue;
+
+      if (!par_read(p)) {
+	close(p->fd);
+	p->fd = -1;
+
+	par_reap(p);
+	running--;
+      }
+    }
+  }
+
+  for (i = 0; i < next; i++) {
+    if (pars[i].fd < 0) continue;
+
+    /* Cut short by an exception. */
+    close(pars[i].fd);
+    pars[i].fd = -1;
+
+    kill(pars[i].last_pid, SIGTERM);
+    par_reap(&pars[i]);
+  }
+
+
+  close(null_fd);
+
+  for (i = n - 1; i >= 0; i--) {
+    char* status = (char*)gc_alloc(sizeof(char) * 16, "parallel_run");
+    list* res;
+
+    sprintf(status, "%d", pars[i].status);
+    pars[i].out[pars[i].len] = '\0';
+
+    res = ls_cons(pars[i].out, ls_cons(status, NULL));
+
+    ret = ls_cons(res, ret);
+    ls_type_set(ret, TYPE_LIST);
+  }
+
+  gc_free(pars);
+  gc_free(fds);
+  gc_free(which);
+
+  if (exception_flag) {
+    ls_free_all(ret);
+    return NULL;
+  }
+
+  return ret;
+}
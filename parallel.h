@@ -0,0 +1,30 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __parallel_h__
+#define __parallel_h__
+
+/*
+ * Running many pipelines at once, at most "limit" at a time, and
+ * collecting what they write.
+ *
+ * Pitfalls:
+ *
+ *  + Every element of "specs" is a pipeline, i.e. a list of commands.
+ *    It can start with a file, which is then the pipeline's input;
+ *    otherwise the input is /dev/null.
+ *  + The result is a list with a "(output status)" list for each
+ *    pipeline, in the order of "specs". A pipeline that couldn't be
+ *    started gets a status of -1; one that was killed gets 128 plus
+ *    the signal number.
+ *  + Only the standard output is collected.
+ *  + After an exception the pipelines still running are terminated,
+ *    and NULL is returned.
+ */
+
+extern list* parallel_run(int limit, list* specs);
+
+#endif /* !__parallel_h__ */
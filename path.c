@@ -0,0 +1,163 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gc.h"
+#include "list.h"
+#include "hash.h"
+#include "path.h"
+
+
+/*
+ * Command names to full paths. An empty string means the command is
+ * not in PATH.
+ */
+static hash_table* paths = NULL;
+
+/*
+ * The last answer that couldn't be cached.
+ */
+static char* scratch = NULL;
+
+
+static char* path_strcpy(char* str, int len) {
+  char* ret = (char*)gc_alloc(sizeof(char) * (len + 1), "path_strcpy");
+
+  memcpy(ret, str, len);
+  ret[len] = '\0';
+
+  return ret;
+}
+
+
+static int path_executable(char* file) {
+  struct stat st;
+
+  return (stat(file, &st) == 0 && S_ISREG(st.st_mode) &&
+	  access(file, X_OK) == 0);
+}
+
+
+/*
+ * Search PATH the way "execvp" does. "cacheable" is cleared if the
+ * answer depends on the current directory.
+ */
+static char* path_search(char* name, int* cacheable) {
+  char* dirs = getenv("PATH");
+  char* end;
+  char* buff;
+  int namelen = strlen(name);
+  int len;
+
+  if (!dirs) dirs = "/bin:/usr/bin";
+
+  while (1) {
+    end = strchr(dirs, ':');
+    len = (end ? end - dirs : strlen(dirs));
+
+    if (!len || dirs[0] != '/') {
+      (*cacheable) = 0;
+    }
+
+    buff = (char*)gc_alloc(sizeof(char) * (len + namelen + 3),
+			   "path_search");
+
+    if (len) {
+      memcpy(buff, dirs, len);
+    } else {
+      buff[len++] = '.';
+    }
+
+    buff[len] = '/';
+    strcpy(buff + len + 1, name);
+
+    if (path_executable(buff)) {
+      return buff;
+    }
+
+    gc_free(buff);
+
+    if (!end) break;
+
+    dirs = end + 1;
+  }
+
+  return NULL;
+}
+
+
+char* path_find(char* name) {
+  char* ret;
+  int cacheable = 1;
+
+  if (strchr(name, '/')) return name;
+
+  if (!paths) {
+    paths = (hash_table*)gc_alloc(sizeof(hash_table), "path_find");
+    hash_init(paths, NULL);
+  }
+
+  ret = hash_get(paths, name);
+
+  if (ret) {
+    return (ret[0] ? ret : NULL);
+  }
+
+  ret = path_search(name, &cacheable);
+
+  if (!cacheable) {
+    /* Good until the next uncached search. */
+    if (scratch) gc_free(scratch);
+
+    scratch = ret;
+    return ret;
+  }
+
+  if (!ret) {
+    ret = path_strcpy("", 0);
+  }
+
+  hash_put(paths, path_strcpy(name, strlen(name)), ret);
+
+  return (ret[0] ? ret : NULL);
+}
+
+
+void path_forget(char* name) {
+  char* old;
+
+  if (!paths) return;
+
+  old = hash_del(paths, name);
+
+  if (old) gc_free(old);
+}
+
+
+void path_rehash(void) {
+  if (!paths) return;
+
+  hash_free(paths, gc_free);
+  hash_init(paths, NULL);
+}
+
+
+void path_done(void) {
+  if (scratch) gc_free(scratch);
+  scratch = NULL;
+
+  if (!paths) return;
+
+  hash_free(paths, gc_free);
+  gc_free(paths);
+  paths = NULL;
+}
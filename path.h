@@ -0,0 +1,33 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __path_h__
+#define __path_h__
+
+/*
+ * A cache of where disk commands are in PATH, so that running the same
+ * command again doesn't search PATH again. Commands that weren't found
+ * are remembered too.
+ *
+ * Pitfalls:
+ *
+ *  + "path_find" returns a string that belongs to the cache, or NULL if
+ *    the command isn't anywhere in PATH. Don't keep the string past the
+ *    next call to "path_forget" or "path_rehash".
+ *  + Names with a slash in them are returned as they are, without
+ *    checking anything.
+ *  + Nothing is cached for relative directories in PATH, since what
+ *    they hold depends on the current directory.
+ *  + The cache doesn't notice commands being installed or removed.
+ *    "path_rehash" empties it; it must be called when PATH changes.
+ */
+
+extern char* path_find(char* name);
+extern void path_forget(char* name);
+extern void path_rehash(void);
+extern void path_done(void);
+
+#endif /* !__path_h__ */
@@ -0,0 +1,127 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <dlfcn.h>
+
+#include "format.h"
+#include "list.h"
+#include "gc.h"
+#include "hash.h"
+#include "job.h"
+#include "token.h"
+#include "esh.h"
+#include "builtins.h"
+#include "esh-plugin.h"
+#include "plugin.h"
+
+
+/*
+ * The handles of the objects loaded so far. The nodes don't own them.
+ */
+static list* loaded = NULL;
+
+
+static int add_builtin(char* name, esh_builtin func, int flags) {
+  if (!name || !func) {
+    error("esh: load-builtins: a plugin registered an empty builtin.");
+    return -1;
+  }
+
+  if (hash_get(builtins, name)) {
+    error("esh: load-builtins: \"%s\" is already a builtin.", name);
+    return -1;
+  }
+
+  hash_put(builtins, dynamic_strcpy(name), func);
+
+  if (flags & ESH_BORROWS) {
+    hash_put(borrowers, dynamic_strcpy(name), func);
+  }
+
+  return 0;
+}
+
+
+static esh_api api = {
+  ESH_PLUGIN_VERSION,
+
+  add_builtin,
+  fancy_typecheck,
+  error,
+
+  ls_cons,
+  ls_next,
+  ls_data,
+  ls_type,
+  ls_type_set,
+  ls_copy,
+  ls_free_all,
+
+  gc_alloc,
+  gc_inc_ref,
+  gc_free,
+
+  NULL,
+  NULL,
+  NULL
+};
+
+
+int plugin_load(char* file) {
+  void* handle;
+  int (*init)(esh_api*);
+  list* iter;
+
+  handle = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+
+  if (!handle) {
+    error("esh: load-builtins: %s.", dlerror());
+    return -1;
+  }
+
+  for (iter = loaded; iter != NULL; iter = ls_next(iter)) {
+    if (ls_data(iter) == handle) {
+      dlclose(handle);
+      return 0;
+    }
+  }
+
+  *(void**)(&init) = dlsym(handle, ESH_PLUGIN_INIT);
+
+  if (!init) {
+    error("esh: load-builtins: \"%s\" has no %s.", file, ESH_PLUGIN_INIT);
+    dlclose(handle);
+    return -1;
+  }
+
+  /*
+   * From here on the plugin may have registered builtins, so it can
+   * never be closed.
+   */
+  loaded = ls_cons(handle, loaded);
+
+  api.ls_true = ls_true;
+  api.ls_false = ls_false;
+  api.ls_void = ls_void;
+
+  if (init(&api)) {
+    error("esh: load-builtins: \"%s\" failed to initialize.", file);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void plugin_done(void) {
+  ls_free(loaded);
+  loaded = NULL;
+}
@@ -0,0 +1,26 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __plugin_h__
+#define __plugin_h__
+
+/*
+ * Loading builtins from shared objects. The plugin side of this is
+ * described in esh-plugin.h.
+ *
+ * Pitfalls:
+ *
+ *  + "plugin_load" returns 0 on success. Errors have been reported by
+ *    then.
+ *  + Loading the same object twice does nothing the second time.
+ *  + The objects stay loaded until the shell exits; "plugin_done" only
+ *    frees the bookkeeping.
+ */
+
+extern int plugin_load(char* file);
+extern void plugin_done(void);
+
+#endif /* !__plugin_h__ */
@@ -0,0 +1,392 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "list.h"
+#include "hash.h"
+#include "profile.h"
+
+
+typedef struct prof_entry prof_entry;
+typedef struct prof_frame prof_frame;
+
+struct prof_entry {
+  char* name;
+  int calls;
+  int active;
+  int allocs;
+  int self_allocs;
+  double wall;
+  double self_wall;
+  double cpu;
+  double self_cpu;
+};
+
+struct prof_frame {
+  prof_entry* entry;
+  int pathlen;
+  int allocs;
+  int child_allocs;
+  double wall;
+  double child_wall;
+  double cpu;
+  double child_cpu;
+};
+
+
+int profiling = 0;
+
+static hash_table* prof_names = NULL;
+static hash_table* prof_stacks = NULL;
+
+static prof_frame prof_frames[PROFILE_DEPTH];
+static int prof_depth = 0;
+static int prof_lost = 0;
+
+static char prof_path[PROFILE_PATH];
+static int prof_pathlen = 0;
+static int prof_pathfull = 0;
+
+
+static double prof_clock(clockid_t clk) {
+  struct timespec ts;
+
+  clock_gettime(clk, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static prof_entry* prof_lookup(hash_table* tab, char* name) {
+  prof_entry* ret = hash_get(tab, name);
+
+  if (!ret) {
+    ret = (prof_entry*)gc_alloc(sizeof(prof_entry), "prof_lookup");
+    memset(ret, 0, sizeof(prof_entry));
+
+    ret->name = (char*)gc_alloc(sizeof(char) * (strlen(name) + 1),
+				"prof_lookup");
+    strcpy(ret->name, name);
+
+    hash_put(tab, ret->name, ret);
+  }
+
+  return ret;
+}
+
+
+static void prof_zero(hash_table* tab) {
+  list* keys = hash_keys(tab);
+  list* iter;
+  prof_entry* e;
+  int active;
+
+  for (iter = keys; iter != NULL; iter = ls_next(iter)) {
+    e = hash_get(tab, ls_data(iter));
+
+    active = e->active;
+    memset(&(e->calls), 0, sizeof(prof_entry) - sizeof(char*));
+    e->active = active;
+  }
+
+  ls_free_all(keys);
+}
+
+
+void profile_start(void) {
+  if (!prof_names) {
+    prof_names = (hash_table*)gc_alloc(sizeof(hash_table), "profile_start");
+    prof_stacks = (hash_table*)gc_alloc(sizeof(hash_table), "profile_start");
+
+    hash_init(prof_names, NULL);
+    hash_init(prof_stacks, NULL);
+
+  } else {
+    prof_zero(prof_names);
+    prof_zero(prof_stacks);
+  }
+
+  profiling = 1;
+}
+
+
+void profile_stop(void) {
+  profiling = 0;
+}
+
+
+void profile_enter(char* name) {
+  prof_frame* f;
+  int len = strlen(name);
+
+  if (prof_depth == PROFILE_DEPTH) {
+    prof_lost++;
+    return;
+  }
+
+  f = &(prof_frames[prof_depth++]);
+
+  f->entry = prof_lookup(prof_names, name);
+  f->entry->active++;
+
+  f->pathlen = prof_pathlen;
+
+  if (!prof_pathfull) {
+    if (prof_pathlen + len + 2 > PROFILE_PATH) {
+      prof_pathfull = prof_depth;
+
+    } else {
+      if (prof_pathlen) {
+	prof_path[prof_pathlen++] = ';';
+      }
+
+      memcpy(prof_path + prof_pathlen, name, len + 1);
+      prof_pathlen += len;
+    }
+  }
+
+  f->child_wall = 0;
+  f->child_cpu = 0;
+  f->child_allocs = 0;
+
+  f->allocs = gc_allocations();
+  f->cpu = prof_clock(CLOCK_PROCESS_CPUTIME_ID);
+  f->wall = prof_clock(CLOCK_MONOTONIC);
+}
+
+
+void profile_leave(void) {
+  double wall = prof_clock(CLOCK_MONOTONIC);
+  double cpu = prof_clock(CLOCK_PROCESS_CPUTIME_ID);
+  int allocs = gc_allocations();
+
+  prof_frame* f;
+  prof_entry* e;
+  prof_entry* s;
+
+  if (prof_lost) {
+    prof_lost--;
+    return;
+  }
+
+  f = &(prof_frames[--prof_depth]);
+  e = f->entry;
+
+  wall -= f->wall;
+  cpu -= f->cpu;
+  allocs -= f->allocs;
+
+  e->calls++;
+  e->active--;
+
+  e->self_wall += wall - f->child_wall;
+  e->self_cpu += cpu - f->child_cpu;
+  e->self_allocs += allocs - f->child_allocs;
+
+  /* Recursive calls are already inside the outermost one. */
+  if (!e->active) {
+    e->wall += wall;
+    e->cpu += cpu;
+    e->allocs += allocs;
+  }
+
+  if (!prof_pathfull) {
+    s = prof_lookup(prof_stacks, prof_path);
+
+    s->calls++;
+    s->self_wall += wall - f->child_wall;
+    s->self_cpu += cpu - f->child_cpu;
+    s->self_allocs += allocs - f->child_allocs;
+  }
+
+  if (prof_pathfull > prof_depth) {
+    prof_pathfull = 0;
+  }
+
+  prof_pathlen = f->pathlen;
+  prof_path[prof_pathlen] = '\0';
+
+  if (prof_depth) {
+    f = &(prof_frames[prof_depth - 1]);
+
+    f->child_wall += wall;
+    f->child_cpu += cpu;
+    f->child_allocs += allocs;
+  }
+}
+
+
+static prof_entry** prof_sorted(hash_table* tab, int* n,
+				int (*cmp)(const void*, const void*)) {
+  list* keys = hash_keys(tab);
+  list* iter;
+  prof_entry** ret;
+  int i = 0;
+
+  for (iter = keys; iter != NULL; iter = ls_next(iter)) {
+    i++;
+  }
+
+  ret = (prof_entry**)gc_alloc(sizeof(prof_entry*) * (i + 1), "prof_sorted");
+
+  i = 0;
+
+  for (iter = keys; iter != NULL; iter = ls_next(iter)) {
+    ret[i++] = hash_get(tab, ls_data(iter));
+  }
+
+  ls_free_all(keys);
+
+  qsort(ret, i, sizeof(prof_entry*), cmp);
+
+  (*n) = i;
+
+  return ret;
+}
+
+
+static int prof_by_wall(const void* a, const void* b) {
+  double x = (*(prof_entry**)a)->wall;
+  double y = (*(prof_entry**)b)->wall;
+
+  return (x < y) - (x > y);
+}
+
+
+static int prof_by_name(const void* a, const void* b) {
+  return strcmp((*(prof_entry**)a)->name, (*(prof_entry**)b)->name);
+}
+
+
+/*
+ * Both reports are built in two passes: the first one, with a NULL
+ * buffer, only measures the length.
+ */
+static int prof_printf(char* buff, int len, const char* fmt, ...) {
+  va_list ap;
+  int ret;
+
+  va_start(ap, fmt);
+
+  if (buff) {
+    ret = vsprintf(buff + len, fmt, ap);
+
+  } else {
+    ret = vsnprintf(NULL, 0, fmt, ap);
+  }
+
+  va_end(ap);
+
+  return ret;
+}
+
+
+static int prof_table(char* buff, prof_entry** tab, int n) {
+  prof_entry* e;
+  int len = 0;
+  int i;
+
+  len += prof_printf(buff, len, "%8s %10s %10s %10s %10s %9s  %s\n",
+		     "calls", "wall ms", "self ms", "cpu ms", "self cpu",
+		     "allocs", "name");
+
+  for (i = 0; i < n; i++) {
+    e = tab[i];
+
+    if (!e->calls) continue;
+
+    len += prof_printf(buff, len,
+		       "%8d %10.3f %10.3f %10.3f %10.3f %9d  %s\n",
+		       e->calls, e->wall * 1000, e->self_wall * 1000,
+		       e->cpu * 1000, e->self_cpu * 1000, e->allocs,
+		       e->name);
+  }
+
+  return len;
+}
+
+
+/*
+ * The "collapsed stack" format: one line per stack, with the self time
+ * in microseconds.
+ */
+static int prof_collapsed(char* buff, prof_entry** tab, int n) {
+  prof_entry* e;
+  int len = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    e = tab[i];
+
+    if (!e->calls) continue;
+
+    len += prof_printf(buff, len, "%s %.0f\n", e->name,
+		       e->self_wall * 1e6);
+  }
+
+  return len;
+}
+
+
+static char* prof_output(hash_table* tab,
+			 int (*cmp)(const void*, const void*),
+			 int (*format)(char*, prof_entry**, int)) {
+  prof_entry** sorted;
+  char* ret;
+  int n = 0;
+  int len;
+
+  if (!tab) {
+    ret = (char*)gc_alloc(sizeof(char), "prof_output");
+    ret[0] = '\0';
+
+    return ret;
+  }
+
+  sorted = prof_sorted(tab, &n, cmp);
+
+  len = format(NULL, sorted, n);
+
+  ret = (char*)gc_alloc(sizeof(char) * (len + 1), "prof_output");
+  ret[0] = '\0';
+
+  format(ret, sorted, n);
+
+  gc_free(sorted);
+
+  return ret;
+}
+
+
+char* profile_report(void) {
+  return prof_output(prof_names, prof_by_wall, prof_table);
+}
+
+
+char* profile_flame(void) {
+  return prof_output(prof_stacks, prof_by_name, prof_collapsed);
+}
+
+
+void profile_done(void) {
+  if (!prof_names) return;
+
+  hash_free(prof_names, gc_free);
+  hash_free(prof_stacks, gc_free);
+
+  gc_free(prof_names);
+  gc_free(prof_stacks);
+
+  prof_names = NULL;
+  prof_stacks = NULL;
+}
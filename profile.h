@@ -0,0 +1,42 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __profile_h__
+#define __profile_h__
+
+/*
+ * The profiler. While "profiling" is set, every command run by
+ * "do_builtin_kind" is bracketed with "profile_enter" and "profile_leave",
+ * which keep a stack of the running commands and charge wall time, CPU
+ * time and memory allocations to each command name and to each distinct
+ * stack of names.
+ *
+ * Pitfalls:
+ *
+ *  + Every "profile_enter" must be matched by a "profile_leave", even if
+ *    profiling was stopped in between.
+ *  + "profile_start" zeroes the counters, it does not forget the names.
+ *  + The CPU time is that of the shell only; child processes don't count.
+ *  + Stacks deeper than PROFILE_DEPTH commands are charged to the command
+ *    at that depth.
+ *  + "profile_report" and "profile_flame" return a freshly allocated
+ *    string.
+ */
+
+#define PROFILE_DEPTH   256
+#define PROFILE_PATH    4096
+
+extern int profiling;
+
+extern void profile_start(void);
+extern void profile_stop(void);
+extern void profile_enter(char* name);
+extern void profile_leave(void);
+extern char* profile_report(void);
+extern char* profile_flame(void);
+extern void profile_done(void);
+
+#endif /* !__profile_h__ */
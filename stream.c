@@ -0,0 +1,126 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "gc.h"
+#include "stream.h"
+
+
+void stream_init(stream_t* s, int fd) {
+  s->fd = fd;
+  s->pos = 0;
+  s->have = 0;
+  s->eof = 0;
+}
+
+
+stream_t* stream_new(int fd) {
+  stream_t* s = (stream_t*)gc_alloc(sizeof(stream_t), "stream_new");
+
+  stream_init(s, fd);
+
+  return s;
+}
+
+
+static int stream_fill(stream_t* s) {
+  int n;
+
+  if (s->eof) return 0;
+
+  do {
+    n = read(s->fd, s->data, STREAM_BLOCK);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    s->eof = 1;
+    n = 0;
+  }
+
+  s->pos = 0;
+  s->have = n;
+
+  return n;
+}
+
+
+/*
+ * Add "n" bytes to a line being put together, growing it by doubling.
+ */
+static void stream_append(char** buff, int* len, int* size,
+			  char* data, int n) {
+  char* tmp;
+
+  if ((*len) + n + 1 > (*size)) {
+    while ((*len) + n + 1 > (*size)) {
+      (*size) *= 2;
+    }
+
+    tmp = (char*)gc_alloc(sizeof(char) * (*size), "stream_append");
+
+    memcpy(tmp, (*buff), (*len));
+    gc_free(*buff);
+    (*buff) = tmp;
+  }
+
+  memcpy((*buff) + (*len), data, n);
+  (*len) += n;
+}
+
+
+char* stream_line(stream_t* s) {
+  char* ret;
+  char* nl;
+  int len = 0;
+  int size = 128;
+  int n;
+
+  if (s->pos == s->have && !stream_fill(s)) {
+    return NULL;
+  }
+
+  ret = (char*)gc_alloc(sizeof(char) * size, "stream_line");
+
+  while (1) {
+    nl = memchr(s->data + s->pos, '\n', s->have - s->pos);
+    n = (nl ? nl - (s->data + s->pos) : s->have - s->pos);
+
+    stream_append(&ret, &len, &size, s->data + s->pos, n);
+
+    s->pos += n;
+
+    if (nl) {
+      s->pos++;
+      break;
+    }
+
+    if (!stream_fill(s)) break;
+  }
+
+  ret[len] = '\0';
+
+  return ret;
+}
+
+
+int stream_eof(stream_t* s) {
+  return (s->pos == s->have && !stream_fill(s));
+}
+
+
+void stream_close(stream_t* s) {
+  if (s->fd >= 0) {
+    close(s->fd);
+  }
+
+  s->fd = -1;
+  s->eof = 1;
+}
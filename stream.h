@@ -0,0 +1,43 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __stream_h__
+#define __stream_h__
+
+/*
+ * A stream is the reading end of a pipeline, read a line at a time
+ * through a buffer of STREAM_BLOCK bytes. It is the data of a
+ * TYPE_STREAM list node, and shared between copies of the node.
+ *
+ * Pitfalls:
+ *
+ *  + "stream_line" blocks until a whole line is there, or the pipeline
+ *    closes its end. It returns NULL at the end of the stream.
+ *  + The newline is not part of the line. The last line need not end
+ *    with a newline.
+ *  + "stream_close" closes the pipe, but doesn't free the stream.
+ *  + "stream_init" is for a stream that is part of something else.
+ */
+
+#define STREAM_BLOCK   4096
+
+typedef struct stream_t stream_t;
+
+struct stream_t {
+  int fd;
+  int pos;
+  int have;
+  int eof;
+  char data[STREAM_BLOCK];
+};
+
+extern void stream_init(stream_t* s, int fd);
+extern stream_t* stream_new(int fd);
+extern char* stream_line(stream_t* s);
+extern int stream_eof(stream_t* s);
+extern void stream_close(stream_t* s);
+
+#endif /* !__stream_h__ */
@@ -0,0 +1,30 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __token_h__
+#define __token_h__
+
+/*
+ * A token is a slice of the tokenizer's input buffer. Since there are
+ * no escape sequences (the backslash quote is gone), the value of a
+ * token is always a contiguous run of input characters, so nothing is
+ * copied until the parser actually wants to keep the string.
+ *
+ * Pitfalls:
+ *
+ *  + The slice is only valid for as long as the input buffer is.
+ *  + Quote characters are not part of the slice.
+ *  + Use "token_strcpy" to get a string you can store in a list.
+ */
+
+typedef struct token_t token_t;
+
+struct token_t {
+  int start;
+  int len;
+};
+
+#endif /* !__token_h__ */
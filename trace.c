@@ -0,0 +1,144 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "trace.h"
+
+
+typedef struct trace_event trace_event;
+
+struct trace_event {
+  struct timespec when;
+  int kind;
+  int depth;
+  int value;
+  char name[TRACE_NAME];
+};
+
+
+int tracing = 0;
+int trace_depth = 0;
+
+static trace_event trace_ring[TRACE_SIZE];
+static unsigned int trace_next = 0;
+
+
+static void trace_signal(int signum) {
+  trace_dump(STDERR_FILENO);
+
+  signal(SIGUSR1, trace_signal);
+}
+
+
+void trace_start(void) {
+  tracing = 1;
+
+  signal(SIGUSR1, trace_signal);
+}
+
+
+void trace_stop(void) {
+  tracing = 0;
+
+  signal(SIGUSR1, SIG_DFL);
+}
+
+
+void trace_record(int kind, char* name, int value) {
+  trace_event* e = &(trace_ring[trace_next % TRACE_SIZE]);
+
+  clock_gettime(CLOCK_REALTIME, &(e->when));
+
+  e->kind = kind;
+  e->depth = trace_depth;
+  e->value = value;
+
+  strncpy(e->name, (name ? name : ""), TRACE_NAME - 1);
+  e->name[TRACE_NAME - 1] = '\0';
+
+  trace_next++;
+}
+
+
+/*
+ * No stdio here, see trace.h.
+ */
+static int trace_number(char* buff, long num, int width) {
+  char tmp[24];
+  int len = 0;
+  int i = 0;
+
+  if (num < 0) {
+    buff[len++] = '-';
+    num = -num;
+  }
+
+  do {
+    tmp[i++] = '0' + (num % 10);
+    num /= 10;
+  } while (num);
+
+  while (i < width) {
+    tmp[i++] = '0';
+  }
+
+  while (i) {
+    buff[len++] = tmp[--i];
+  }
+
+  return len;
+}
+
+
+static int trace_string(char* buff, char* str) {
+  int len = strlen(str);
+
+  memcpy(buff, str, len);
+
+  return len;
+}
+
+
+void trace_dump(int fd) {
+  static char* kinds[] = { "call", "fork", "wait", "done" };
+
+  char buff[TRACE_NAME + 128];
+  trace_event* e;
+  unsigned int i;
+  int len;
+
+  i = (trace_next > TRACE_SIZE ? trace_next - TRACE_SIZE : 0);
+
+  for (; i != trace_next; i++) {
+    e = &(trace_ring[i % TRACE_SIZE]);
+    len = 0;
+
+    len += trace_number(buff + len, e->when.tv_sec, 1);
+    buff[len++] = '.';
+    len += trace_number(buff + len, e->when.tv_nsec / 1000, 6);
+    buff[len++] = ' ';
+    len += trace_number(buff + len, e->depth, 1);
+    buff[len++] = ' ';
+    len += trace_string(buff + len, kinds[e->kind]);
+    buff[len++] = ' ';
+    len += trace_string(buff + len, e->name);
+
+    if (e->kind != TRACE_CALL) {
+      buff[len++] = ' ';
+      len += trace_number(buff + len, e->value, 1);
+    }
+
+    buff[len++] = '\n';
+
+    write(fd, buff, len);
+  }
+}
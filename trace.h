@@ -0,0 +1,40 @@
+/*
+ * esh, the Unix shell with Lisp-like syntax.
+ * Copyright (C) 1999  Ivan Tkatchev
+ * This source code is under the GPL.
+ */
+
+#ifndef __trace_h__
+#define __trace_h__
+
+/*
+ * The trace: a ring of the last TRACE_SIZE things the shell did, kept in
+ * a static array, so that recording an event never allocates memory.
+ * While "tracing" is set, the ring can be dumped with SIGUSR1.
+ *
+ * Pitfalls:
+ *
+ *  + Command names are cut to TRACE_NAME-1 characters.
+ *  + "trace_dump" only uses "write", so it is safe in a signal handler;
+ *    an event being recorded at that moment may come out garbled.
+ *  + "trace_depth" counts the running defines; it is kept up to date
+ *    even when tracing is off.
+ */
+
+#define TRACE_SIZE   1024
+#define TRACE_NAME   32
+
+#define TRACE_CALL   0
+#define TRACE_FORK   1
+#define TRACE_WAIT   2
+#define TRACE_DONE   3
+
+extern int tracing;
+extern int trace_depth;
+
+extern void trace_start(void);
+extern void trace_stop(void);
+extern void trace_record(int kind, char* name, int value);
+extern void trace_dump(int fd);
+
+#endif /* !__trace_h__ */